@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+Strong and weak scaling of tdma_2d_mpi on one machine.
+
+Runs the solver headless under mpirun for every rank count and reports steps per second, the parallel efficiency
+against the run on one rank and the share of the time spent communicating (from --profile), as CSV and JSON.
+
+    strong scaling: the global grid stays nx x ny whatever the number of ranks
+    weak scaling:   every rank keeps rows-per-rank rows, the global grid grows to (P * rows-per-rank) x ny
+
+Open MPI gets --oversubscribe so rank counts above the number of cores still run, e.g. on a laptop.
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+
+
+def mpirun_flags(mpirun):
+    """extra flags for running more ranks than cores, only Open MPI needs them"""
+    try:
+        version = subprocess.run([mpirun, "--version"], capture_output=True, text=True).stdout
+    except OSError:
+        return []
+    if "Open MPI" not in version and "OpenRTE" not in version:
+        return []
+    flags = ["--oversubscribe", "--bind-to", "none"]
+    if os.geteuid() == 0:
+        flags.append("--allow-run-as-root")
+    return flags
+
+
+def run(args, ranks, nx, ny):
+    cmd = [args.mpirun, "-n", str(ranks)] + mpirun_flags(args.mpirun) + [
+        args.exe, "--headless", str(args.steps), "--nx", str(nx), "--ny", str(ny),
+        "--halo", args.halo, "--profile"]
+    env = dict(os.environ, OMP_NUM_THREADS=str(args.threads))
+    out = subprocess.run(cmd, capture_output=True, text=True, env=env, cwd=args.workdir)
+    for line in out.stdout.splitlines():
+        if line.startswith("RESULT "):
+            return json.loads(line[len("RESULT "):])
+    sys.stderr.write(" ".join(cmd) + "\n" + out.stdout + out.stderr)
+    raise RuntimeError("no result from %d ranks" % ranks)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--exe", default="./task2_mpi")
+    parser.add_argument("--mpirun", default="mpirun")
+    parser.add_argument("--ranks", default="", help="comma separated rank counts, default 1, 2, 4 ... up to --max-ranks")
+    parser.add_argument("--max-ranks", type=int, default=os.cpu_count() or 1)
+    parser.add_argument("--threads", type=int, default=1, help="OMP_NUM_THREADS of every rank")
+    parser.add_argument("--steps", type=int, default=200)
+    parser.add_argument("--nx", type=int, default=2000, help="rows of the strong scaling grid")
+    parser.add_argument("--ny", type=int, default=1000, help="columns of both grids")
+    parser.add_argument("--rows-per-rank", type=int, default=500, help="rows of every rank for weak scaling")
+    parser.add_argument("--halo", default="p2p", choices=["p2p", "shm", "rma-fence", "rma-pscw"])
+    parser.add_argument("--mode", default="both", choices=["strong", "weak", "both"])
+    parser.add_argument("--csv", default="mpi_scaling.csv")
+    parser.add_argument("--json", default="mpi_scaling.json")
+    parser.add_argument("--workdir", default=None, help="where the ranks write their profile traces")
+    args = parser.parse_args()
+
+    if args.ranks:
+        ranks = [int(r) for r in args.ranks.split(",")]
+    else:
+        ranks, p = [], 1
+        while p < args.max_ranks:
+            ranks.append(p)
+            p *= 2
+        ranks.append(args.max_ranks)
+    if ranks[0] != 1:
+        ranks.insert(0, 1)
+
+    modes = ["strong", "weak"] if args.mode == "both" else [args.mode]
+    rows = []
+    for mode in modes:
+        base = None
+        for p in ranks:
+            nx = args.nx if mode == "strong" else args.rows_per_rank * p
+            r = run(args, p, nx, args.ny)
+            if base is None:
+                base = r["steps_per_s"]
+            # strong: p ranks should do p times the steps, weak: the same steps on p times the cells
+            speedup = r["steps_per_s"] / base
+            r["mode"] = mode
+            r["speedup"] = speedup if mode == "strong" else speedup * p
+            r["efficiency"] = speedup / p if mode == "strong" else speedup
+            rows.append(r)
+            print("%-6s ranks %3d  grid %6d x %-6d  %10.2f steps/s  efficiency %6.1f%%  comm %5.1f%%" % (
+                mode, p, nx, args.ny, r["steps_per_s"], 100 * r["efficiency"], 100 * (r["comm_fraction"] or 0)))
+
+    fields = ["mode", "ranks", "threads", "nx", "ny", "halo", "steps", "seconds", "steps_per_s",
+              "speedup", "efficiency", "comm_fraction"]
+    with open(args.csv, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=fields, extrasaction="ignore")
+        writer.writeheader()
+        writer.writerows(rows)
+    with open(args.json, "w") as f:
+        json.dump(rows, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,481 @@
+#include "iostream"
+#include "vector"
+#include "string"
+#include "cstring"
+#include "cstdlib"
+#include "cmath"
+#include "algorithm"
+#include "chrono"
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "omp.h"
+
+#include "../include/Matrix.h"
+#include "../include/Thomas1d.h"
+#include "../include/Heat2d.h"
+#include "../include/Config.h"
+#include "../include/Ensemble.h"
+#include "../include/Amr.h"
+#include "../include/Counters.h"
+
+/*
+ * Micro benchmarks of the kernels of the solvers:
+ *		tdma1d			the 1 dimension thomas solve of tdma_1d, N from 1e2 up to --max-n
+ *		row_sweep		all the calculateFixRow of a grid, one thread, for grids of the same size and different shapes
+ *		col_sweep		all the column solves of the same grids, in blocks of SWEEP_BLOCK columns
+ *		step_change		the rms difference of two grids, the change of a step
+ *		adi_step		a whole time step of tdma_2d (copy, row and column sweeps) at 1, 2, 4 ... --max-threads threads
+ *		problem_step	a time step on one thread of the plate, of the plate with a uniform conductivity (the kernels
+ *						specialized for it), of the plate given as std::function (a problem known at runtime) and of
+ *						the plate of a config lowered to face arrays (include/Config.h) and of the same config on a
+ *						grid stretched around the edges of its patch
+ *		ensemble_step	a time step on one thread of 16 members of the config plate that differ in their borders and
+ *						time step, one after the other and together in the lanes of include/Ensemble.h
+ *		amr_step		a coarse time step on one thread of the plate refined twice by the patches of include/Amr.h, and the
+ *						two steps of dt / 2 of the uniform fine grid of the same resolution, the rate is in fine cells
+ *		matrix_copy		operator= of matrix_t into a matrix of the same size
+ *		matrix_swap		swap of two matrix_t
+ *
+ * every benchmark runs its kernel enough times in a row for a repetition to last --min-time, then --warmup repetitions
+ * that are thrown away and --reps timed ones. the median and the median absolute deviation of the time per call are
+ * printed and written to a json file, to be compared between two builds.
+ *
+ * the omp threads are pinned one per cpu of the affinity mask of the process, unless OMP_PROC_BIND is set or --no-pin.
+ *
+ * with --counters the sweeps of every grid shape run --reps more times under the hardware counters (include/Counters.h)
+ * and their IPC, bytes per cell and roofline position are printed and added to their json results. the bandwidth roof
+ * is a triad measured on one thread unless --peak-gbs is given, the compute roof is --peak-gflops.
+ *
+ * tdma1d, row_sweep, col_sweep and step_change run once per instruction set variant of the kernels the cpu supports (see
+ * include/Isa.h), or only the one given with --isa. adi_step runs the variant the solvers pick.
+ */
+
+// the element type of tdma_2d
+using data_t = float;
+
+struct result_t {
+	std::string name;
+	std::string params;
+	double items;
+	const char* unit;
+	size_t iters;
+	double median, mad, min;
+	double ipc = NAN, bytes_per_cell = NAN, llc_per_cell = NAN, dtlb_per_cell = NAN, fp_vector_per_cell = NAN;
+};
+
+std::vector<result_t> g_results;
+std::vector<int> g_cpus;
+bool g_pin = true;
+int g_warmup = 3, g_reps = 11;
+double g_min_time = 2e-3;
+const char* g_filter = nullptr;
+bool g_counters_on = false;
+double g_peak_gbs = 0, g_peak_gflops = 0;
+counters_t g_counters;
+plate_problem_t g_plate;
+std::vector<isa_t> g_isas;
+
+double now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double median(std::vector<double> v) {
+	std::sort(v.begin(), v.end());
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// run the omp team with n threads, thread k pinned to the k-th cpu the process may run on
+void setThreads(int n) {
+	omp_set_num_threads(n);
+	if (!g_pin || g_cpus.empty()) return;
+
+#pragma omp parallel
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(g_cpus[omp_get_thread_num() % g_cpus.size()], &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+}
+
+bool selected(const std::string& name, const std::string& params) {
+	return !g_filter || (name + " " + params).find(g_filter) != std::string::npos;
+}
+
+// time f, items is the work of one call in unit (cells, bytes ...) for the rates
+template <typename F>
+void run(const std::string& name, const std::string& params, double items, const char* unit, F f) {
+	if (!selected(name, params))
+		return;
+
+	auto batch = [&](size_t iters) {
+		double t = now();
+		for (size_t k = 0; k < iters; ++k)
+			f();
+		return now() - t;
+	};
+
+	// grow the batch until a repetition lasts long enough for the clock
+	size_t iters = 1;
+	double t = batch(iters);
+	while (t < g_min_time && iters < ((size_t) 1 << 30)) {
+		iters = std::max(iters * 2, (size_t)(iters * g_min_time / std::max(t, 1e-9)));
+		t = batch(iters);
+	}
+
+	for (int w = 0; w < g_warmup; ++w)
+		batch(iters);
+
+	std::vector<double> times(g_reps), dev(g_reps);
+	for (int r = 0; r < g_reps; ++r)
+		times[r] = batch(iters) / iters;
+
+	double med = median(times);
+	for (int r = 0; r < g_reps; ++r)
+		dev[r] = std::fabs(times[r] - med);
+	result_t res;
+	res.name = name;
+	res.params = params;
+	res.items = items;
+	res.unit = unit;
+	res.iters = iters;
+	res.median = med;
+	res.mad = median(dev);
+	res.min = *std::min_element(times.begin(), times.end());
+	g_results.push_back(res);
+
+	printf("%-12s %-28s %12.3f us %9.3f us %8.2f%% %12.3f G%s/s\n", name.c_str(), params.c_str(), med * 1e6,
+		   res.mad * 1e6, 100 * res.mad / med, items / med * 1e-9, unit);
+	fflush(stdout);
+}
+
+void benchThomas(long max_n) {
+	std::vector<double> v_yi;
+	for (long N = 100; N <= max_n; N *= 10)
+		for (isa_t isa : g_isas)
+			run("tdma1d", "n=" + std::to_string(N) + " isa=" + isa_names[isa], N, "cells", [&] {thomasIsa(isa, v_yi, N);});
+}
+
+// the counters of a phase go to the result of the same benchmark
+void addCounters(const std::string& name, const std::string& params, int phase) {
+	for (result_t& r : g_results) {
+		if (r.name != name || r.params != params) continue;
+		r.ipc = g_counters.ipc(phase);
+		r.bytes_per_cell = g_counters.bytesPerCell(phase);
+		r.llc_per_cell = g_counters.perCell(phase, COUNTER_LLC_MISSES);
+		r.dtlb_per_cell = g_counters.perCell(phase, COUNTER_DTLB_MISSES);
+		r.fp_vector_per_cell = g_counters.perCell(phase, COUNTER_FP_VECTOR);
+	}
+}
+
+// the hardware counters of the row and the column sweeps of a grid, on one thread
+void countSweeps(const std::string& params, isa_t isa, matrix_t<data_t>& M, matrix_t<data_t>& M2) {
+	bool rows = selected("row_sweep", params), cols = selected("col_sweep", params);
+	if (!rows && !cols) return;
+
+	g_counters.init({"row_sweep", "col_sweep"}, {SWEEP_FLOPS, SWEEP_FLOPS}, 1);
+	double cells = (double) M.N() * M.M();
+	for (int r = 0; r < g_reps; ++r) {
+		g_counters.begin(0);
+		sweepRowsIsa(isa, g_plate, M, M2);
+		g_counters.end(0, 0);
+		g_counters.begin(0);
+		sweepColsIsa(isa, g_plate, M2, M);
+		g_counters.end(0, 1);
+		g_counters.addCells(0, cells);
+		g_counters.addCells(1, cells);
+		g_counters.step();
+	}
+
+	printf("\n%s\n", params.c_str());
+	g_counters.report(stdout, g_peak_gbs, g_peak_gflops);
+	printf("\n");
+	addCounters("row_sweep", params, 0);
+	addCounters("col_sweep", params, 1);
+	g_counters.release();
+}
+
+void benchSweeps() {
+	// the same number of cells in every shape
+	const size_t shapes[][2] = {{64, 16384}, {256, 4096}, {1024, 1024}, {4096, 256}, {16384, 64}};
+	matrix_t<data_t> M, M2;
+
+	setThreads(1);
+	for (auto& s : shapes) {
+		for (isa_t isa : g_isas) {
+			std::string params = "nx=" + std::to_string(s[0]) + " ny=" + std::to_string(s[1]) + " isa=" + isa_names[isa];
+			initMatrix(g_plate, M, s[0], s[1]);
+			M2 = M;
+			run("row_sweep", params, s[0] * s[1], "cells", [&] {sweepRowsIsa(isa, g_plate, M, M2);});
+			run("col_sweep", params, s[0] * s[1], "cells", [&] {sweepColsIsa(isa, g_plate, M2, M);});
+			if (g_counters_on)
+				countSweeps(params, isa, M, M2);
+		}
+	}
+}
+
+void benchResidual() {
+	const size_t sizes[] = {1024, 4096};
+	matrix_t<data_t> A, B;
+
+	setThreads(1);
+	for (size_t n : sizes) {
+		initMatrix(g_plate, A, n, n);
+		B = A;
+		for (isa_t isa : g_isas)
+			run("step_change", "n=" + std::to_string(n) + " isa=" + isa_names[isa], n * n, "cells",
+				[&] {stepChangeIsa(isa, A, B);});
+	}
+}
+
+void benchSteps(int max_threads) {
+	const size_t sizes[] = {512, 2048};
+	matrix_t<data_t> M, M2;
+
+	std::vector<int> counts;
+	for (int t = 1; t < max_threads; t *= 2)
+		counts.push_back(t);
+	counts.push_back(max_threads);
+
+	for (size_t n : sizes) {
+		for (int t : counts) {
+			setThreads(t);
+			initMatrix(g_plate, M, n, n);
+			run("adi_step", "n=" + std::to_string(n) + " threads=" + std::to_string(t), n * n, "cells",
+				[&] {adiStep(g_plate, M, M2);});
+		}
+	}
+}
+
+void benchProblems() {
+	const size_t n = 1024;
+	matrix_t<data_t> M, M2;
+
+	uniform_problem_t uniform(1e-4);
+	runtime_problem_t runtime;
+	runtime.conductivity.lambda = [](double x, double y) {return LMD(x, y);};
+	runtime.boundary.left = [](double) {return 600.0;};
+	runtime.boundary.right = [](double) {return 1200.0;};
+	runtime.boundary.bottom = [](double x) {return 600 * (1 + x);};
+	runtime.boundary.top = [](double x) {return 600 * (1 + x * x);};
+	runtime.boundary.initial = [](double, double) {return 300.0;};
+	runtime.source.f = [](double, double) {return 0.0;};
+	runtime.dt = DT;
+
+	// the plate of the defaults of Config.h, lowered to face arrays
+	config_problem_t<data_t> table;
+	plate_config_t().lower(table, n, n);
+	plate_config_t clustered;
+	clustered.cluster_x = {0.25, 0.65};
+	clustered.cluster_y = {0.1, 0.25};
+	config_problem_t<data_t, stretched_grid_t> stretched;
+	clustered.lower(stretched, n, n);
+
+	setThreads(1);
+	std::string params = "n=" + std::to_string(n) + " problem=";
+	initMatrix(g_plate, M, n, n);
+	run("problem_step", params + "plate", n * n, "cells", [&] {adiStep(g_plate, M, M2);});
+	initMatrix(uniform, M, n, n);
+	run("problem_step", params + "uniform", n * n, "cells", [&] {adiStep(uniform, M, M2);});
+	initMatrix(runtime, M, n, n);
+	run("problem_step", params + "runtime", n * n, "cells", [&] {adiStep(runtime, M, M2);});
+	initMatrix(table, M, n, n);
+	run("problem_step", params + "table", n * n, "cells", [&] {adiStep(table, M, M2);});
+	initMatrix(stretched, M, n, n);
+	run("problem_step", params + "stretched", n * n, "cells", [&] {adiStep(stretched, M, M2);});
+}
+
+void benchEnsemble() {
+	const size_t n = 256, K = 16;
+
+	plate_config_t config;
+	config_problem_t<data_t> table;
+	config.lower(table, n, n);
+
+	std::vector<config_problem_t<data_t>> problems(K, table);
+	std::vector<matrix_t<data_t>> fields(K);
+	ensemble_t<data_t> E, E2;
+	E.init(K, n, n);
+	for (size_t k = 0; k < K; ++k) {
+		plate_config_t m = config;
+		m.dt = config.dt * (1 + k % 4) / 2;
+		m.left = {600.0 + 50 * k};
+		m.lowerBorders(problems[k]);
+		initMatrix(problems[k], fields[k], n, n);
+		E.set(k, fields[k], problems[k].dt);
+	}
+
+	setThreads(1);
+	matrix_t<data_t> M2;
+	std::string params = "n=" + std::to_string(n) + " K=" + std::to_string(K) + " layout=";
+	run("ensemble_step", params + "members", n * n * K, "cells", [&] {
+		for (size_t k = 0; k < K; ++k)
+			adiStep(problems[k], fields[k], M2);
+	});
+	run("ensemble_step", params + "lanes", n * n * K, "cells", [&] {adiStepLanes(table, E, E2);});
+}
+
+void benchAmr() {
+	const size_t n = 256, ratio = 2, fine = ratio * (n + 1) - 1;
+	matrix_t<data_t> M, M2;
+
+	plate_problem_t plate = g_plate;
+	plate.dt = g_plate.dt / ratio;
+	amr_t<plate_problem_t, data_t> amr;
+	amr.ratio = ratio;
+	amr.init(g_plate, n, n);
+
+	setThreads(1);
+	std::string params = "n=" + std::to_string(n) + " ratio=" + std::to_string(ratio) + " grid=";
+	initMatrix(plate, M, fine, fine);
+	run("amr_step", params + "uniform", fine * fine, "cells", [&] {
+		for (size_t s = 0; s < ratio; ++s)
+			adiStep(plate, M, M2);
+	});
+	run("amr_step", params + "patches", fine * fine, "cells", [&] {amr.step();});
+}
+
+void benchMatrix() {
+	const size_t sizes[] = {256, 1024, 4096};
+	matrix_t<data_t> A, B;
+
+	setThreads(1);
+	for (size_t n : sizes) {
+		A.init(n, n);
+		B.init(n, n);
+		std::fill(A.data(), A.data() + (n + 2) * (n + 2), data_t(1));
+		double bytes = 2.0 * (n + 2) * (n + 2) * sizeof(data_t);
+		run("matrix_copy", "n=" + std::to_string(n), bytes, "B", [&] {B = A;});
+		run("matrix_swap", "n=" + std::to_string(n), 1, "swaps", [&] {A.swap(B);});
+	}
+}
+
+bool writeJson(const char* path, int max_threads) {
+	FILE* f = fopen(path, "w");
+	if (!f) return false;
+
+	char date[32];
+	time_t t = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+
+	fprintf(f, "{\n  \"meta\": {\"date\": \"%s\", \"compiler\": \"%s\", \"data_t\": \"float\", \"max_threads\": %d, "
+			   "\"pinned\": %s, \"warmup\": %d, \"reps\": %d, \"min_time\": %g, \"isa\": \"%s\"},\n  \"results\": [\n",
+			date, __VERSION__, max_threads, g_pin ? "true" : "false", g_warmup, g_reps, g_min_time, isa_names[isaSelected()]);
+	// the counters that were not measured or not available are null
+	auto number = [](double v) {
+		char buf[32];
+		if (std::isnan(v)) snprintf(buf, sizeof(buf), "null");
+		else snprintf(buf, sizeof(buf), "%.6g", v);
+		return std::string(buf);
+	};
+	for (size_t k = 0; k < g_results.size(); ++k) {
+		const result_t& r = g_results[k];
+		fprintf(f, "    {\"name\": \"%s\", \"params\": \"%s\", \"iters\": %zu, \"median_s\": %.9g, \"mad_s\": %.9g, "
+				   "\"min_s\": %.9g, \"items\": %.9g, \"unit\": \"%s\", \"per_s\": %.9g",
+				r.name.c_str(), r.params.c_str(), r.iters, r.median, r.mad, r.min, r.items, r.unit, r.items / r.median);
+		if (g_counters_on && (r.name == "row_sweep" || r.name == "col_sweep"))
+			fprintf(f, ", \"ipc\": %s, \"bytes_per_cell\": %s, \"llc_per_cell\": %s, \"dtlb_per_cell\": %s, "
+					   "\"fp_vector_per_cell\": %s", number(r.ipc).c_str(), number(r.bytes_per_cell).c_str(),
+					number(r.llc_per_cell).c_str(), number(r.dtlb_per_cell).c_str(), number(r.fp_vector_per_cell).c_str());
+		fprintf(f, "}%s\n", k + 1 < g_results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	return fclose(f) == 0;
+}
+
+// the options, on stderr for an unknown one
+void usage(FILE* f) {
+	fprintf(f, "usage: tdma_bench [options]\n"
+			   "  --json <file>          the results, tdma_bench.json by default\n"
+			   "  --reps <n>             the timed repetitions of every benchmark, 11 by default\n"
+			   "  --warmup <n>           the repetitions thrown away before them, 3 by default\n"
+			   "  --min-time <s>         the shortest time of a repetition, 2e-3 by default\n"
+			   "  --max-n <n>            the largest N of tdma1d, 1e8 by default\n"
+			   "  --max-threads <n>      the most threads of adi_step, all of them by default\n"
+			   "  --filter <text>        only the benchmarks whose name and params contain it\n"
+			   "  --no-pin               do not pin the omp threads\n"
+			   "  --isa <name>           only this variant of the kernels: sse2, avx2 or avx512\n"
+			   "  --counters             the hardware counters of the sweeps\n"
+			   "  --peak-gbs <GB/s>      the bandwidth roof instead of a measured triad\n"
+			   "  --peak-gflops <GF/s>   the compute roof\n");
+}
+
+// Main program
+int main(int argc, char** argv) {
+	const char* json = "tdma_bench.json";
+	long max_n = 100000000;
+	int max_threads = omp_get_max_threads();
+	const char* isa = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			json = argv[++i];
+		else if (std::strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+			g_reps = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+			g_warmup = std::max(0L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+			g_min_time = std::strtod(argv[++i], nullptr);
+		else if (std::strcmp(argv[i], "--max-n") == 0 && i + 1 < argc)
+			max_n = std::max(100.0, std::strtod(argv[++i], nullptr));
+		else if (std::strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc)
+			max_threads = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			g_filter = argv[++i];
+		else if (std::strcmp(argv[i], "--no-pin") == 0)
+			g_pin = false;
+		else if (std::strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+			isa = argv[++i];
+		else if (std::strcmp(argv[i], "--counters") == 0)
+			g_counters_on = true;
+		else if (std::strcmp(argv[i], "--peak-gbs") == 0 && i + 1 < argc)
+			g_peak_gbs = std::strtod(argv[++i], nullptr);
+		else if (std::strcmp(argv[i], "--peak-gflops") == 0 && i + 1 < argc)
+			g_peak_gflops = std::strtod(argv[++i], nullptr);
+		else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+			usage(stdout);
+			return 0;
+		} else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			usage(stderr);
+			return 1;
+		}
+	}
+
+	for (int k = 0; k < ISA_COUNT; ++k)
+		if (isaSupported((isa_t) k) && (!isa || std::strcmp(isa, isa_names[k]) == 0))
+			g_isas.push_back((isa_t) k);
+
+	// the cpus the process may run on, before any thread is pinned
+	g_pin = g_pin && !getenv("OMP_PROC_BIND");
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int c = 0; c < CPU_SETSIZE; ++c)
+			if (CPU_ISSET(c, &set))
+				g_cpus.push_back(c);
+	}
+
+	printf("%-12s %-28s %15s %12s %9s %16s\n", "benchmark", "params", "median", "mad", "mad %", "rate");
+	setThreads(1);
+	// the sweeps are counted on one thread, so is the bandwidth of their roof
+	if (g_counters_on && g_peak_gbs <= 0)
+		g_peak_gbs = triadBandwidth();
+	benchThomas(max_n);
+	benchSweeps();
+	benchResidual();
+	benchSteps(max_threads);
+	benchProblems();
+	benchEnsemble();
+	benchAmr();
+	benchMatrix();
+
+	if (!writeJson(json, max_threads)) {
+		std::cerr << "cannot write " << json << std::endl;
+		return 1;
+	}
+	std::cout << g_results.size() << " results written to " << json << std::endl;
+}
@@ -0,0 +1,540 @@
+#ifndef TDMA_AMR_H
+#define TDMA_AMR_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Matrix.h"
+#include "Heat2d.h"
+
+/*
+ * Block structured adaptive refinement of the plate on two levels: the whole plate on a coarse grid, and rectangular
+ * patches of it refined ratio times along both axes where the field or the conductivity changes quickly. every grid is
+ * a matrix_t stepped by the kernels of Heat2d.h; a patch is the same problem over its own rectangle, its border ring
+ * holds the ghost values around it.
+ *
+ * a patch owns a box of coarse nodes, its fine grid covers the box grown by overlap nodes and reaches the lines of
+ * coarse nodes around that, which carry its ghost ring: every ratio-th fine node is a coarse one, and a patch touching a
+ * border of the plate has the border itself as its ghosts, like a uniform fine grid. a coarse step is:
+ *		- the step of the coarse grid, over every node including the ones under the patches
+ *		- ratio steps of dt / ratio of every patch (subcycling). the ghost values are taken from the borders of the
+ *		  plate, copied from the patch next to it, or interpolated along the coarse lines at the middle of the substep
+ *		- reflux: the coarse nodes on the edge of a box took the coarse flux through the faces of their cell that lie
+ *		  inside of the box, the difference to the fine flux through the same faces summed over the substeps is spread
+ *		  by one implicit coarse step, as an explicit correction is unstable for the steps the scheme allows
+ *		- the coarse nodes of a box take the value of their fine node
+ * the overlap keeps the errors of the ghost ring away from the values a patch gives back.
+ *
+ * over a step of the Peaceman-Rachford scheme the heat through a face is dt times the mean of the flux before and
+ * after the step across x, and the flux of the field between the two sweeps across y.
+ *
+ * the coarse nodes are flagged where two neighbours differ by more than gradient kelvin or their conductivities by
+ * more than a factor jump, grown by buffer nodes, and clustered into patches (Berger-Rigoutsos) every regrid coarse
+ * steps. a new patch keeps the fine values of the old ones it overlaps and interpolates the coarse field elsewhere.
+ * patches only exist on a uniform grid with a conductivity given at any point: the faces of a table are lowered for
+ * one grid.
+ */
+
+// a box of coarse nodes, the rows [i0, i1) and the columns [j0, j1)
+struct amr_box_t {
+	size_t i0, i1, j0, j1;
+	size_t rows() const {return i1 - i0;}
+	size_t cols() const {return j1 - j0;}
+};
+
+// the problem of the plate P on a patch, a window of the whole fine grid
+template <typename P>
+using amr_problem_t = problem_t<decltype(P::conductivity), decltype(P::boundary), decltype(P::source), window_grid_t>;
+
+template <typename P, typename data_t>
+struct amr_patch_t {
+	// the coarse nodes the patch gives its values to, and the ones its fine grid covers: the box grown by the overlap
+	amr_box_t box, extent;
+
+	// the problem over the fine nodes of the extent with a step of dt / ratio, its node 0 on the coarse line
+	// extent.i0 - 1: the origin of the plate, the spacing of the fine grid and the index of its node 0 in it, so that
+	// its nodes have the coordinates of the same nodes of the whole fine grid
+	amr_problem_t<P> problem;
+	matrix_t<data_t> M, M2, old;
+
+	data_t x(size_t a) const {return nodeX(problem, (data_t)((problem.lxn - problem.lx0) / M.N()), (int) a);}
+	data_t y(size_t c) const {return nodeY(problem, (data_t)((problem.lyn - problem.ly0) / M.M()), (int) c);}
+
+	// the heat through the faces of the coarse nodes on the left, right, bottom and top edges, fine minus coarse
+	std::vector<double> flux[4];
+};
+
+template <typename P, typename data_t>
+struct amr_t {
+	static_assert(P::is_uniform_grid && !P::is_tabulated_conductivity,
+				  "the patches need a uniform grid and a conductivity at any point");
+
+	P problem;
+
+	// the coarse grid, the field between its sweeps and the one before its step
+	matrix_t<data_t> M, M2, old;
+
+	// the implicit halves of a coarse step factored once for the reflux, at i * (Ny + 2) + j: along y for the rows and
+	// along x for the columns
+	struct factor_t {
+		double lower, alph, inv;
+	};
+	std::vector<factor_t> rows, cols;
+	std::vector<amr_patch_t<P, data_t>> patches;
+
+	size_t ratio = 2, regrid = 10, buffer = 2, overlap = 2;
+	double gradient = 20, jump = 2, efficiency = 0.7;
+	long steps = 0;
+
+	// the plate of the problem on a Nx x Ny coarse grid, its patches on the initial values
+	void init(const P& coarse, size_t Nx, size_t Ny) {
+		problem = coarse;
+		initMatrix(problem, M, Nx, Ny);
+
+		data_t dx = (data_t)(problem.lxn - problem.lx0) / Nx;
+		data_t dy = (data_t)(problem.lyn - problem.ly0) / Ny;
+		auto X = [&](int k) {return nodeX(problem, dx, k);};
+		auto Y = [&](int k) {return nodeY(problem, dy, k);};
+		double ax = problem.dt / (2 * (double) dx * dx), ay = problem.dt / (2 * (double) dy * dy);
+		size_t stride = Ny + 2;
+		rows.assign((Nx + 2) * stride, {0, 0, 0});
+		cols.assign((Nx + 2) * stride, {0, 0, 0});
+		for (size_t i = 1; i < Nx + 1; ++i)
+			for (size_t j = 1; j < Ny + 1; ++j) {
+				factor_t& r = rows[i * stride + j];
+				r.lower = ay * faceConductivity(problem, X, Y, i, j - 1, i, j);
+				double upper = ay * faceConductivity(problem, X, Y, i, j + 1, i, j);
+				r.inv = 1 / (1 + r.lower + upper - r.lower * rows[i * stride + j - 1].alph);
+				r.alph = upper * r.inv;
+			}
+		for (size_t i = 1; i < Nx + 1; ++i)
+			for (size_t j = 1; j < Ny + 1; ++j) {
+				factor_t& c = cols[i * stride + j];
+				c.lower = ax * faceConductivity(problem, X, Y, i - 1, j, i, j);
+				double upper = ax * faceConductivity(problem, X, Y, i + 1, j, i, j);
+				c.inv = 1 / (1 + c.lower + upper - c.lower * cols[(i - 1) * stride + j].alph);
+				c.alph = upper * c.inv;
+			}
+		patches.clear();
+		steps = 0;
+		rebuild(true);
+	}
+
+	double dx() const {return (problem.lxn - problem.lx0) / M.N();}
+	double dy() const {return (problem.lyn - problem.ly0) / M.M();}
+
+	// the fine nodes against the ones of a uniform grid of the fine spacing over the plate
+	double coverage() const {
+		double fine = 0;
+		for (auto& p : patches)
+			fine += (double) p.M.N() * p.M.M();
+		return fine / ((double) (ratio * (M.N() + 1) - 1) * (ratio * (M.M() + 1) - 1));
+	}
+
+	void step() {
+		if (regrid > 0 && steps > 0 && steps % regrid == 0)
+			rebuild(false);
+
+		old = M;
+		adiStep(problem, M, M2);
+		for (auto& p : patches)
+			coarseFlux(p);
+
+		for (size_t s = 0; s < ratio; ++s) {
+			for (auto& p : patches)
+				fillGhosts(p, (s + 0.5) / ratio);
+			for (auto& p : patches) {
+				p.old = p.M;
+				adiStep(p.problem, p.M, p.M2);
+				fineFlux(p);
+			}
+		}
+
+		sync();
+		for (auto& p : patches)
+			inject(p);
+		++steps;
+	}
+
+	// the heat through the face between the nodes (i, j) and (i + 1, j) of a grid of the problem q over its step, from
+	// the fields before and after it, and through the one between (i, j) and (i, j + 1) from the field between the sweeps
+	template <typename Q>
+	static double heatX(const Q& q, const matrix_t<data_t>& before, const matrix_t<data_t>& after, size_t i, size_t j) {
+		data_t dx = (data_t)(q.lxn - q.lx0) / before.N();
+		data_t dy = (data_t)(q.lyn - q.ly0) / before.M();
+		auto X = [&](int k) {return nodeX(q, dx, k);};
+		auto Y = [&](int k) {return nodeY(q, dy, k);};
+		double lambda = faceConductivity(q, X, Y, i + 1, j, i, j);
+		double d = (double) before[i + 1][j] - before[i][j] + after[i + 1][j] - after[i][j];
+		return q.dt * lambda * d / (2 * (double) dx);
+	}
+
+	template <typename Q>
+	static double heatY(const Q& q, const matrix_t<data_t>& half, size_t i, size_t j) {
+		data_t dx = (data_t)(q.lxn - q.lx0) / half.N();
+		data_t dy = (data_t)(q.lyn - q.ly0) / half.M();
+		auto X = [&](int k) {return nodeX(q, dx, k);};
+		auto Y = [&](int k) {return nodeY(q, dy, k);};
+		double lambda = faceConductivity(q, X, Y, i, j + 1, i, j);
+		return q.dt * lambda * ((double) half[i][j + 1] - half[i][j]) / dy;
+	}
+
+	// the coarse field at (x, y), bilinear between the nodes and linear in time from the field before the step (t = 0)
+	// to the one after it (t = 1)
+	double coarse(double x, double y, double t) const {
+		double fi = std::clamp((x - problem.lx0) / dx(), 0.0, (double) M.N() + 1);
+		double fj = std::clamp((y - problem.ly0) / dy(), 0.0, (double) M.M() + 1);
+		size_t i = std::min((size_t) fi, M.N()), j = std::min((size_t) fj, M.M());
+		double a = fi - i, b = fj - j;
+		auto at = [&](const matrix_t<data_t>& A) {
+			return (1 - a) * ((1 - b) * A[i][j] + b * A[i][j + 1]) + a * ((1 - b) * A[i + 1][j] + b * A[i + 1][j + 1]);
+		};
+		return t >= 1 ? at(M) : (1 - t) * at(old) + t * at(M);
+	}
+
+	// the fine node (g, h) counted over the whole plate, ratio * i being the coarse node i: the patch it is inside of,
+	// the one whose box holds it first, and its node there
+	const amr_patch_t<P, data_t>* finePatch(size_t g, size_t h, const amr_patch_t<P, data_t>* skip, size_t& a,
+											size_t& c) const {
+		auto inside = [&](const amr_box_t& b) {
+			return g > (b.i0 - 1) * ratio && g < b.i1 * ratio && h > (b.j0 - 1) * ratio && h < b.j1 * ratio;
+		};
+		for (int pass = 0; pass < 2; ++pass)
+			for (auto& p : patches)
+				if (&p != skip && inside(pass == 0 ? p.box : p.extent)) {
+					a = g - (p.extent.i0 - 1) * ratio;
+					c = h - (p.extent.j0 - 1) * ratio;
+					return &p;
+				}
+		return nullptr;
+	}
+
+	// the border ring of a patch at the fraction t of the coarse step: the borders of the plate, the nodes of a
+	// neighbouring patch, or the coarse field
+	void fillGhosts(amr_patch_t<P, data_t>& p, double t) {
+		size_t n = p.M.N(), m = p.M.M();
+		size_t g0 = (p.extent.i0 - 1) * ratio, h0 = (p.extent.j0 - 1) * ratio;
+		size_t gn = (M.N() + 1) * ratio, hn = (M.M() + 1) * ratio;
+		auto ghost = [&](size_t a, size_t c) {
+			size_t g = g0 + a, gh = h0 + c, qa, qc;
+			data_t x = p.x(a), y = p.y(c);
+			const amr_patch_t<P, data_t>* q;
+			if (g == 0)
+				p.M[a][c] = problem.boundary.x0(y);
+			else if (g == gn)
+				p.M[a][c] = problem.boundary.xn(y);
+			else if (gh == 0)
+				p.M[a][c] = problem.boundary.y0(x);
+			else if (gh == hn)
+				p.M[a][c] = problem.boundary.yn(x);
+			else if ((q = finePatch(g, gh, &p, qa, qc)))
+				p.M[a][c] = q->M[qa][qc];
+			else
+				p.M[a][c] = (data_t) coarse(x, y, t);
+		};
+		for (size_t a = 0; a < n + 2; ++a) {
+			ghost(a, 0);
+			ghost(a, m + 1);
+		}
+		for (size_t c = 1; c < m + 1; ++c) {
+			ghost(0, c);
+			ghost(n + 1, c);
+		}
+	}
+
+	// the registers start with minus the heat the coarse step put through the faces of the edge nodes
+	void coarseFlux(amr_patch_t<P, data_t>& p) {
+		const amr_box_t& b = p.box;
+		p.flux[0].assign(b.cols(), 0.0);
+		p.flux[1].assign(b.cols(), 0.0);
+		p.flux[2].assign(b.rows(), 0.0);
+		p.flux[3].assign(b.rows(), 0.0);
+		for (size_t j = b.j0; j < b.j1; ++j) {
+			p.flux[0][j - b.j0] = -heatX(problem, old, M, b.i0 - 1, j);
+			p.flux[1][j - b.j0] = -heatX(problem, old, M, b.i1 - 1, j);
+		}
+		for (size_t i = b.i0; i < b.i1; ++i) {
+			p.flux[2][i - b.i0] = -heatY(problem, M2, i, b.j0 - 1);
+			p.flux[3][i - b.i0] = -heatY(problem, M2, i, b.j1 - 1);
+		}
+	}
+
+	// the heat of one substep through the faces of the edge nodes, half a coarse spacing inside of the box. the face
+	// is a fine node for an even ratio, the mean of the fine faces on both sides of it, and it spans the fine lines
+	// ratio / 2 either side of the coarse line, the outer ones weighed half for an even ratio
+	void fineFlux(amr_patch_t<P, data_t>& p) {
+		const amr_box_t& b = p.box;
+		const amr_box_t& e = p.extent;
+		size_t lo = (ratio - 1) / 2, hi = ratio / 2;
+		size_t left = (b.i0 - e.i0) * ratio, right = (b.i1 - e.i0 + 1) * ratio - 1;
+		size_t bottom = (b.j0 - e.j0) * ratio, top = (b.j1 - e.j0 + 1) * ratio - 1;
+		auto weight = [&](long k) {return ratio % 2 == 0 && (size_t) std::abs(k) == hi ? 0.5 / ratio : 1.0 / ratio;};
+		for (size_t j = 0; j < b.cols(); ++j)
+			for (long k = -(long) hi; k <= (long) hi; ++k) {
+				size_t c = (b.j0 - e.j0 + j + 1) * ratio + k;
+				double w = weight(k) / 2;
+				p.flux[0][j] += w * (heatX(p.problem, p.old, p.M, left + lo, c) + heatX(p.problem, p.old, p.M, left + hi, c));
+				p.flux[1][j] += w * (heatX(p.problem, p.old, p.M, right - hi, c) + heatX(p.problem, p.old, p.M, right - lo, c));
+			}
+		for (size_t i = 0; i < b.rows(); ++i)
+			for (long k = -(long) hi; k <= (long) hi; ++k) {
+				size_t a = (b.i0 - e.i0 + i + 1) * ratio + k;
+				double w = weight(k) / 2;
+				p.flux[2][i] += w * (heatY(p.problem, p.M2, a, bottom + lo) + heatY(p.problem, p.M2, a, bottom + hi));
+				p.flux[3][i] += w * (heatY(p.problem, p.M2, a, top - hi) + heatY(p.problem, p.M2, a, top - lo));
+			}
+	}
+
+	// the difference goes to the coarse nodes on the edges, d[i * (Ny + 2) + j], the borders of the plate keep their
+	// values
+	void reflux(const amr_patch_t<P, data_t>& p, std::vector<double>& d) const {
+		const amr_box_t& b = p.box;
+		size_t stride = M.M() + 2;
+		double dx = this->dx(), dy = this->dy();
+		for (size_t j = b.j0; j < b.j1; ++j) {
+			if (b.i0 > 1)
+				d[(b.i0 - 1) * stride + j] += p.flux[0][j - b.j0] / dx;
+			if (b.i1 < M.N() + 1)
+				d[b.i1 * stride + j] -= p.flux[1][j - b.j0] / dx;
+		}
+		for (size_t i = b.i0; i < b.i1; ++i) {
+			if (b.j0 > 1)
+				d[i * stride + b.j0 - 1] += p.flux[2][i - b.i0] / dy;
+			if (b.j1 < M.M() + 1)
+				d[i * stride + b.j1] -= p.flux[3][i - b.i0] / dy;
+		}
+	}
+
+	// the reflux of every patch spread by the implicit halves of a step, (1 - dt Lx / 2) (1 - dt Ly / 2) c = d, and
+	// added to the coarse field and to the fine nodes under it. added as it is, the heat moved to the edge nodes
+	// takes out the implicit coupling of their face and the step grows unstable once lambda dt / dx^2 is about 1
+	void sync() {
+		size_t N = M.N(), Ny = M.M(), stride = Ny + 2;
+		std::vector<double> d((N + 2) * stride, 0.0);
+		for (auto& p : patches)
+			reflux(p, d);
+
+		// the rows without any reflux stay zero, the columns are solved side by side like the sweeps
+#pragma omp parallel
+		{
+#pragma omp for schedule(dynamic, 16)
+			for (size_t i = 1; i < N + 1; ++i) {
+				double* v = d.data() + i * stride;
+				const factor_t* f = rows.data() + i * stride;
+				if (std::all_of(v + 1, v + Ny + 1, [](double e) {return e == 0;}))
+					continue;
+				for (size_t j = 1; j < Ny + 1; ++j)
+					v[j] = (v[j] + f[j].lower * v[j - 1]) * f[j].inv;
+				for (size_t j = Ny - 1; j > 0; --j)
+					v[j] += f[j].alph * v[j + 1];
+			}
+
+			size_t blocks = (Ny + SWEEP_BLOCK - 1) / SWEEP_BLOCK;
+#pragma omp for
+			for (size_t k = 0; k < blocks; ++k) {
+				size_t j0 = 1 + k * SWEEP_BLOCK, j1 = std::min(j0 + SWEEP_BLOCK, Ny + 1);
+				for (size_t i = 1; i < N + 1; ++i) {
+					double* v = d.data() + i * stride;
+					const factor_t* f = cols.data() + i * stride;
+					for (size_t j = j0; j < j1; ++j)
+						v[j] = (v[j] + f[j].lower * v[j - stride]) * f[j].inv;
+				}
+				for (size_t i = N - 1; i > 0; --i) {
+					double* v = d.data() + i * stride;
+					const factor_t* f = cols.data() + i * stride;
+					for (size_t j = j0; j < j1; ++j)
+						v[j] += f[j].alph * v[j + stride];
+				}
+			}
+		}
+
+		for (size_t i = 1; i < N + 1; ++i)
+			for (size_t j = 1; j < Ny + 1; ++j)
+				M[i][j] += (data_t) d[i * stride + j];
+
+		// the fine nodes take the correction bilinearly between the coarse nodes
+		for (auto& p : patches) {
+			size_t n = p.M.N(), m = p.M.M();
+			size_t g0 = (p.extent.i0 - 1) * ratio, h0 = (p.extent.j0 - 1) * ratio;
+			for (size_t a = 1; a < n + 1; ++a) {
+				size_t g = g0 + a, i = g / ratio;
+				double u = (double) (g % ratio) / ratio;
+				for (size_t c = 1; c < m + 1; ++c) {
+					size_t h = h0 + c, j = h / ratio;
+					double w = (double) (h % ratio) / ratio;
+					const double* r0 = d.data() + i * stride + j;
+					const double* r1 = r0 + stride;
+					p.M[a][c] += (data_t)((1 - u) * ((1 - w) * r0[0] + w * r0[1]) + u * ((1 - w) * r1[0] + w * r1[1]));
+				}
+			}
+		}
+	}
+
+	// the coarse nodes under a patch take the value of their fine node
+	void inject(const amr_patch_t<P, data_t>& p) {
+		const amr_box_t& b = p.box;
+		for (size_t i = b.i0; i < b.i1; ++i)
+			for (size_t j = b.j0; j < b.j1; ++j)
+				M[i][j] = p.M[(i - p.extent.i0 + 1) * ratio][(j - p.extent.j0 + 1) * ratio];
+	}
+
+	// the coarse nodes to refine, grown by buffer nodes
+	void flag(std::vector<char>& flags) const {
+		size_t N = M.N(), Ny = M.M();
+		data_t dx = (data_t)(problem.lxn - problem.lx0) / N;
+		data_t dy = (data_t)(problem.lyn - problem.ly0) / Ny;
+		auto lambda = [&](size_t i, size_t j) {return problem.conductivity(nodeX(problem, dx, i), nodeY(problem, dy, j));};
+
+		std::vector<char> raw((N + 2) * (Ny + 2), 0);
+		for (size_t i = 1; i < N + 1; ++i)
+			for (size_t j = 1; j < Ny + 1; ++j) {
+				const size_t ni[4] = {i - 1, i + 1, i, i}, nj[4] = {j, j, j - 1, j + 1};
+				bool f = false;
+				for (int e = 0; e < 4; ++e) {
+					double a = lambda(i, j), c = lambda(ni[e], nj[e]);
+					f |= std::fabs((double) M[i][j] - M[ni[e]][nj[e]]) > gradient;
+					f |= std::max(a, c) > jump * std::min(a, c);
+				}
+				raw[i * (Ny + 2) + j] = f;
+			}
+
+		flags.assign(raw.size(), 0);
+		for (size_t i = 1; i < N + 1; ++i)
+			for (size_t j = 1; j < Ny + 1; ++j) {
+				if (!raw[i * (Ny + 2) + j])
+					continue;
+				for (size_t a = std::max(i, buffer + 1) - buffer; a < std::min(N + 1, i + buffer + 1); ++a)
+					for (size_t c = std::max(j, buffer + 1) - buffer; c < std::min(Ny + 1, j + buffer + 1); ++c)
+						flags[a * (Ny + 2) + c] = 1;
+			}
+	}
+
+	// where to split a signature of counts of flagged nodes: the hole nearest its middle, else the strongest change of
+	// sign of its second difference, 0 when it has neither
+	static size_t cut(const std::vector<size_t>& sig, bool& hole) {
+		size_t n = sig.size(), best = 0;
+		hole = false;
+		for (size_t k = 1; k + 1 < n; ++k)
+			if (sig[k] == 0 && (!hole || std::abs((long) (2 * k) - (long) n) < std::abs((long) (2 * best) - (long) n))) {
+				best = k;
+				hole = true;
+			}
+		if (hole)
+			return best;
+
+		long strength = 0;
+		for (size_t k = 2; k + 1 < n; ++k) {
+			long l0 = (long) sig[k - 2] - 2 * (long) sig[k - 1] + (long) sig[k];
+			long l1 = (long) sig[k - 1] - 2 * (long) sig[k] + (long) sig[k + 1];
+			if ((l0 < 0) != (l1 < 0) && std::abs(l1 - l0) > strength) {
+				strength = std::abs(l1 - l0);
+				best = k;
+			}
+		}
+		return best;
+	}
+
+	// the boxes covering the flagged nodes of b, each with at least efficiency of them flagged
+	void cluster(const std::vector<char>& flags, amr_box_t b, std::vector<amr_box_t>& out) const {
+		size_t stride = M.M() + 2;
+		std::vector<size_t> si(b.rows(), 0), sj(b.cols(), 0);
+		size_t count = 0;
+		for (size_t i = b.i0; i < b.i1; ++i)
+			for (size_t j = b.j0; j < b.j1; ++j)
+				if (flags[i * stride + j]) {
+					si[i - b.i0]++;
+					sj[j - b.j0]++;
+					count++;
+				}
+		if (count == 0)
+			return;
+
+		// shrink to the flagged nodes
+		size_t a0 = 0, a1 = si.size(), c0 = 0, c1 = sj.size();
+		while (si[a0] == 0) ++a0;
+		while (si[a1 - 1] == 0) --a1;
+		while (sj[c0] == 0) ++c0;
+		while (sj[c1 - 1] == 0) --c1;
+		amr_box_t s = {b.i0 + a0, b.i0 + a1, b.j0 + c0, b.j0 + c1};
+		if (count >= efficiency * s.rows() * s.cols() || (s.rows() < 2 && s.cols() < 2)) {
+			out.push_back(s);
+			return;
+		}
+
+		// a hole splits first, then an inflection, then the middle of the longer side
+		std::vector<size_t> ti(si.begin() + a0, si.begin() + a1), tj(sj.begin() + c0, sj.begin() + c1);
+		bool hi, hj;
+		size_t ki = cut(ti, hi), kj = cut(tj, hj);
+		bool rows;
+		if (hi != hj)
+			rows = hi;
+		else if (ki != 0 && kj != 0)
+			rows = s.rows() >= s.cols();
+		else if (ki != 0 || kj != 0)
+			rows = ki != 0;
+		else {
+			rows = s.rows() >= s.cols();
+			ki = s.rows() / 2;
+			kj = s.cols() / 2;
+		}
+
+		if (rows) {
+			cluster(flags, {s.i0, s.i0 + ki, s.j0, s.j1}, out);
+			cluster(flags, {s.i0 + ki, s.i1, s.j0, s.j1}, out);
+		} else {
+			cluster(flags, {s.i0, s.i1, s.j0, s.j0 + kj}, out);
+			cluster(flags, {s.i0, s.i1, s.j0 + kj, s.j1}, out);
+		}
+	}
+
+	// new patches over the flagged nodes, on the initial values of the problem or on the fields of the old patches and
+	// of the coarse grid
+	void rebuild(bool initial) {
+		std::vector<char> flags;
+		flag(flags);
+		std::vector<amr_box_t> boxes;
+		cluster(flags, {1, M.N() + 1, 1, M.M() + 1}, boxes);
+
+		double h = dx() / ratio, k = dy() / ratio;
+		std::vector<amr_patch_t<P, data_t>> fresh(boxes.size());
+		for (size_t q = 0; q < boxes.size(); ++q) {
+			amr_patch_t<P, data_t>& p = fresh[q];
+			const amr_box_t& b = boxes[q];
+			p.box = b;
+			p.extent = {std::max(b.i0, overlap + 1) - overlap, std::min(b.i1 + overlap, M.N() + 1),
+						std::max(b.j0, overlap + 1) - overlap, std::min(b.j1 + overlap, M.M() + 1)};
+			size_t n = (p.extent.rows() + 1) * ratio - 1, m = (p.extent.cols() + 1) * ratio - 1;
+			size_t g0 = (p.extent.i0 - 1) * ratio, h0 = (p.extent.j0 - 1) * ratio;
+
+			p.problem.conductivity = problem.conductivity;
+			p.problem.boundary = problem.boundary;
+			p.problem.source = problem.source;
+			p.problem.lx0 = problem.lx0;
+			p.problem.ly0 = problem.ly0;
+			p.problem.grid.row0 = (int) g0;
+			p.problem.grid.col0 = (int) h0;
+			p.problem.lxn = problem.lx0 + n * h;
+			p.problem.lyn = problem.ly0 + m * k;
+			p.problem.dt = problem.dt / ratio;
+			p.M.init(n, m);
+
+			for (size_t a = 1; a < n + 1; ++a)
+				for (size_t c = 1; c < m + 1; ++c) {
+					data_t x = p.x(a), y = p.y(c);
+					size_t qa, qc;
+					const amr_patch_t<P, data_t>* o = initial ? nullptr : finePatch(g0 + a, h0 + c, nullptr, qa, qc);
+					if (initial)
+						p.M[a][c] = problem.boundary.t0(x, y);
+					else if (o)
+						p.M[a][c] = o->M[qa][qc];
+					else
+						p.M[a][c] = (data_t) coarse(x, y, 1);
+				}
+		}
+		patches.swap(fresh);
+	}
+};
+
+#endif //TDMA_AMR_H
@@ -0,0 +1,100 @@
+#ifndef TDMA_COLORMAP_H
+#define TDMA_COLORMAP_H
+
+#include <stddef.h>
+#include <algorithm>
+
+#include "imgui.h"
+
+#include "Matrix.h"
+#include "Isa.h"
+
+// the colormaps a field can be drawn with
+enum colormap_kind_t { COLORMAP_HSV, COLORMAP_VIRIDIS, COLORMAP_INFERNO, COLORMAP_COUNT };
+inline const char* colormap_names[COLORMAP_COUNT] = {"hsv", "viridis", "inferno"};
+
+/*
+ * A colormap precomputed into a lookup table of packed ImU32 colors, so that coloring a cell is a scale, a clamp
+ * and a load instead of an HSV conversion.
+ *
+ * the perceptual maps are interpolated from 10 evenly spaced samples of the matplotlib maps, the hsv map is the
+ * one the plotters always used: hue 0.1, value 0.5 and the saturation going from 0 at min to 1 at max.
+ */
+struct colormap_t {
+
+	static const int SIZE = 1024;
+
+	ImU32 lut[SIZE];
+	float min = 0, max = 1;
+	colormap_kind_t kind = COLORMAP_HSV;
+
+	void build(colormap_kind_t k, float lo, float hi) {
+		static const unsigned char samples[2][10][3] = {
+			// viridis
+			{{68, 1, 84}, {72, 40, 120}, {62, 73, 137}, {49, 104, 142}, {38, 130, 142},
+			 {31, 158, 137}, {53, 183, 121}, {110, 206, 88}, {181, 222, 43}, {253, 231, 37}},
+			// inferno
+			{{0, 0, 4}, {27, 12, 65}, {74, 12, 107}, {120, 28, 109}, {165, 44, 96},
+			 {207, 68, 70}, {237, 105, 37}, {251, 155, 6}, {247, 209, 61}, {252, 255, 164}},
+		};
+
+		kind = k;
+		min = lo;
+		max = hi;
+
+		for (int i = 0; i < SIZE; ++i) {
+			float t = i / float(SIZE - 1);
+			float r, g, b;
+
+			if (kind == COLORMAP_HSV) {
+				ImGui::ColorConvertHSVtoRGB(0.1f, t, 0.5f, r, g, b);
+			} else {
+				const unsigned char (*s)[3] = samples[kind - COLORMAP_VIRIDIS];
+				int k0 = std::min(int(t * 9), 8);
+				float f = t * 9 - k0;
+				r = ((1 - f) * s[k0][0] + f * s[k0 + 1][0]) / 255.0f;
+				g = ((1 - f) * s[k0][1] + f * s[k0 + 1][1]) / 255.0f;
+				b = ((1 - f) * s[k0][2] + f * s[k0 + 1][2]) / 255.0f;
+			}
+			lut[i] = ImGui::ColorConvertFloat4ToU32({r, g, b, 1.0f});
+		}
+	}
+
+	// color n values, values out of [min, max] (and NaNs) get the colors of the ends of the map
+	template <typename T>
+	void colorize(const T* src, ImU32* dst, size_t n) const;
+
+	// color the rows [i0, i1) of M with their border columns into consecutive rows of out
+	template <typename T>
+	void colorize(const matrix_t<T>& M, size_t i0, size_t i1, ImU32* out) const {
+		size_t cols = M.M() + 2;
+
+#pragma omp parallel for schedule(static)
+		for (size_t i = i0; i < i1; ++i)
+			colorize(M[i], out + (i - i0) * cols, cols);
+	}
+};
+
+template <typename T>
+void colorizeKernel(const colormap_t& cmap, const T* src, ImU32* dst, size_t n) {
+	const float min = cmap.min;
+	const float scale = cmap.max > cmap.min ? (colormap_t::SIZE - 1) / (cmap.max - cmap.min) : 0.0f;
+	const float last = colormap_t::SIZE - 1;
+
+#pragma omp simd
+	for (size_t k = 0; k < n; ++k) {
+		float t = ((float) src[k] - min) * scale;
+		t = std::min(std::max(0.0f, t), last);
+		dst[k] = cmap.lut[(int) t];
+	}
+}
+
+// the lookups are gathers with AVX2 and AVX-512
+ISA_DISPATCH(colorizeLine, colorizeKernel)
+
+template <typename T>
+void colormap_t::colorize(const T* src, ImU32* dst, size_t n) const {
+	colorizeLine(*this, src, dst, n);
+}
+
+#endif //TDMA_COLORMAP_H
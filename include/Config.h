@@ -0,0 +1,383 @@
+#ifndef TDMA_CONFIG_H
+#define TDMA_CONFIG_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Problem.h"
+#include "MaterialMap.h"
+
+/*
+ * The plate of tdma_2d and tdma_2d_mpi read from a text file at startup, one key = value per line, # starts a comment:
+ *		lx0, lxn, ly0, lyn		the domain [lx0, lxn] x [ly0, lyn]
+ *		nx, ny					the cells of the grid
+ *		dt						the time step
+ *		left, right				the borders x = lx0 and x = lxn, the coefficients c0 c1 c2 ... of a polynomial in y
+ *		bottom, top				the borders y = ly0 and y = lyn, a polynomial in x
+ *		initial					the initial value of the cells
+ *		conductivity			the conductivity outside of the patches
+ *		map						a file with the conductivity over the whole plate instead (see MaterialMap.h), a path
+ *								relative to the config file
+ *		map_size				the pixels along x and y of a raw float32 map
+ *		map_range				the conductivities of black and white of a pgm or png map
+ *		patch					x0 x1 y0 y1 lambda, a rectangle of conductivity lambda with its bounds. every patch line
+ *								adds one, a later patch covers the earlier ones
+ *		cluster_x, cluster_y	coordinates along x and y the nodes of a stretched grid gather around, e.g. the edges of
+ *								the patches
+ *		cluster					ratio width: the spacing at those coordinates is ratio times smaller than away from
+ *								them, over a band of about width on both sides (4 and 0.02 by default)
+ *
+ * an ensemble file (loadMembers) holds one member per line, the keys dt, left, right, bottom, top and initial of a config
+ * separated by ';' over a plate, e.g. "dt = 0.005; left = 700".
+ *
+ * the keys a file does not give keep the values of the plate of Heat2d.h. lower() turns the description into a problem
+ * for one grid: the conductivity of every face of the cells is computed once into the arrays the sweeps read, so a
+ * step costs the same whatever the number of patches or the map, and the borders are only evaluated by initMatrix.
+ */
+
+struct patch_t {
+	double x0, x1, y0, y1, lambda;
+};
+
+template <typename data_t, typename Grid = uniform_grid_t>
+struct config_problem_t : problem_t<face_conductivity_t<data_t>, polynomial_boundary_t, no_source_t, Grid> {};
+
+struct plate_config_t {
+	// the plate of Heat2d.h, its float constants as floats so that the defaults give the same grid
+	double lx0 = 0, lxn = 1, ly0 = 0, lyn = 0.5;
+	size_t nx = 200, ny = 100;
+	double dt = 0.01f;
+	std::vector<double> left = {600}, right = {1200}, bottom = {600, 600}, top = {600, 0, 600};
+	double initial = 300;
+	double conductivity = 1e-4;
+	std::vector<patch_t> patches = {{0.25, 0.65f, 0.1f, 0.25, 1e-3}};
+
+	// the coordinates a stretched grid refines around, a uniform grid without them
+	std::vector<double> cluster_x, cluster_y;
+	double cluster_ratio = 4, cluster_width = 0.02;
+
+	// the map of the conductivity, mapped once by load() and shared by the copies of the config
+	std::shared_ptr<material_map_t> map;
+
+	// read the keys of a file over the defaults, prints the first error with its line and returns false
+	bool load(const char* path) {
+		std::ifstream in(path);
+		if (!in) {
+			std::cerr << "failed to open " << path << std::endl;
+			return false;
+		}
+		return read(in, path);
+	}
+
+	// the keys of a stream, path names it in the errors and is where the map is relative to
+	bool read(std::istream& in, const std::string& path) {
+		// the first patch line replaces the default patch, a map replaces the patches unless the file has some
+		bool patched = false;
+		std::string map_path;
+		size_t map_size[2] = {0, 0};
+		double map_range[2] = {1e-4, 1e-3};
+		std::string line;
+		for (int n = 1; std::getline(in, line); ++n) {
+			line = line.substr(0, line.find('#'));
+			size_t eq = line.find('=');
+			std::string key;
+			std::istringstream(line.substr(0, eq)) >> key;
+			if (key.empty())
+				continue;
+
+			// the one key that is a path
+			if (key == "map") {
+				std::string value;
+				if (eq != std::string::npos)
+					std::istringstream(line.substr(eq + 1)) >> value;
+				if (value.empty()) {
+					std::cerr << path << ":" << n << ": map takes a path" << std::endl;
+					return false;
+				}
+				map_path = value[0] == '/' || path.find('/') == std::string::npos ? value
+						 : path.substr(0, path.rfind('/') + 1) + value;
+				continue;
+			}
+
+			std::vector<double> v;
+			if (eq != std::string::npos) {
+				std::istringstream values(line.substr(eq + 1));
+				for (double d; values >> d;)
+					v.push_back(d);
+				if (!values.eof()) {
+					std::cerr << path << ":" << n << ": " << key << " has a value that is not a number" << std::endl;
+					return false;
+				}
+			}
+
+			const char* error = nullptr;
+			auto one = [&](double& dst) {if (v.size() == 1) dst = v[0]; else error = "takes one value";};
+			auto count = [&](size_t& dst) {
+				if (v.size() == 1 && v[0] >= 1 && v[0] == (size_t) v[0]) dst = v[0]; else error = "takes a count";
+			};
+			auto poly = [&](std::vector<double>& dst) {if (!v.empty()) dst = v; else error = "takes coefficients";};
+			auto coords = [&](std::vector<double>& dst) {if (!v.empty()) dst = v; else error = "takes coordinates";};
+
+			if (key == "lx0") one(lx0);
+			else if (key == "lxn") one(lxn);
+			else if (key == "ly0") one(ly0);
+			else if (key == "lyn") one(lyn);
+			else if (key == "nx") count(nx);
+			else if (key == "ny") count(ny);
+			else if (key == "dt") one(dt);
+			else if (key == "left") poly(left);
+			else if (key == "right") poly(right);
+			else if (key == "bottom") poly(bottom);
+			else if (key == "top") poly(top);
+			else if (key == "initial") one(initial);
+			else if (key == "conductivity") one(conductivity);
+			else if (key == "map_size") {
+				if (v.size() == 2 && v[0] >= 1 && v[1] >= 1) {
+					map_size[0] = v[0];
+					map_size[1] = v[1];
+				} else {
+					error = "takes the pixels along x and y";
+				}
+			} else if (key == "map_range") {
+				if (v.size() == 2) {
+					map_range[0] = v[0];
+					map_range[1] = v[1];
+				} else {
+					error = "takes the conductivities of black and white";
+				}
+			} else if (key == "cluster_x") {
+				coords(cluster_x);
+			} else if (key == "cluster_y") {
+				coords(cluster_y);
+			} else if (key == "cluster") {
+				if (v.size() == 2 && v[0] >= 1 && v[1] > 0) {
+					cluster_ratio = v[0];
+					cluster_width = v[1];
+				} else {
+					error = "takes a ratio of at least 1 and a width";
+				}
+			} else if (key == "patch") {
+				if (v.size() != 5) {
+					error = "takes x0 x1 y0 y1 lambda";
+				} else {
+					if (!patched)
+						patches.clear();
+					patched = true;
+					patches.push_back({v[0], v[1], v[2], v[3], v[4]});
+				}
+			} else {
+				error = "is not a key";
+			}
+
+			if (error) {
+				std::cerr << path << ":" << n << ": " << key << " " << error << std::endl;
+				return false;
+			}
+		}
+
+		if (lxn <= lx0 || lyn <= ly0 || dt <= 0) {
+			std::cerr << path << ": the domain is empty or the time step is not positive" << std::endl;
+			return false;
+		}
+
+		if (!map_path.empty()) {
+			if (!patched)
+				patches.clear();
+			map = std::make_shared<material_map_t>();
+			if (!map->open(map_path.c_str(), map_size[0], map_size[1], map_range[0], map_range[1]))
+				return false;
+		}
+		return true;
+	}
+
+	// the conductivity at a point of conductivity k without the patches, the last patch holding it or k
+	double lambda(double x, double y, double k) const {
+		for (const patch_t& p : patches)
+			if (x >= p.x0 && x <= p.x1 && y >= p.y0 && y <= p.y1)
+				k = p.lambda;
+		return k;
+	}
+
+	// the members of an ensemble file over this plate, false with the line of the first member that is not valid
+	bool loadMembers(const char* path, std::vector<plate_config_t>& members) const {
+		std::ifstream in(path);
+		if (!in) {
+			std::cerr << "failed to open " << path << std::endl;
+			return false;
+		}
+
+		members.clear();
+		std::string line;
+		for (int n = 1; std::getline(in, line); ++n) {
+			line = line.substr(0, line.find('#'));
+			if (line.find_first_not_of(" \t\r") == std::string::npos)
+				continue;
+			std::replace(line.begin(), line.end(), ';', '\n');
+			std::istringstream keys(line);
+			plate_config_t m = *this;
+			std::string name = std::string(path) + ":" + std::to_string(n);
+			if (!m.read(keys, name))
+				return false;
+
+			// the members share the grid and the conductivity, only the borders and the time step are theirs
+			bool same = m.lx0 == lx0 && m.lxn == lxn && m.ly0 == ly0 && m.lyn == lyn && m.nx == nx && m.ny == ny &&
+						m.conductivity == conductivity && m.map == map && m.patches.size() == patches.size() &&
+						m.cluster_x == cluster_x && m.cluster_y == cluster_y && m.cluster_ratio == cluster_ratio &&
+						m.cluster_width == cluster_width;
+			for (size_t k = 0; same && k < patches.size(); ++k)
+				same = m.patches[k].x0 == patches[k].x0 && m.patches[k].x1 == patches[k].x1 &&
+					   m.patches[k].y0 == patches[k].y0 && m.patches[k].y1 == patches[k].y1 &&
+					   m.patches[k].lambda == patches[k].lambda;
+			if (!same) {
+				std::cerr << name << ": a member only sets dt, left, right, bottom, top and initial" << std::endl;
+				return false;
+			}
+			members.push_back(m);
+		}
+		if (members.empty()) {
+			std::cerr << path << " has no members" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// whether the grid is stretched, lowered to a config_problem_t with a stretched_grid_t
+	bool stretched() const {return !cluster_x.empty() || !cluster_y.empty();}
+
+	// the nodes 0 .. n + 2 of an axis [l0, ln] of n cells, the nodes past n at the spacing of the last cell. the density
+	// of the nodes is a gaussian bump of height ratio and half width cluster_width at the centers over 1 elsewhere: node
+	// k is where the integral of the density reaches k / n of the whole. without centers the nodes are evenly spaced
+	std::vector<double> axis(double l0, double ln, size_t n, const std::vector<double>& centers) const {
+		std::vector<double> nodes(n + 3);
+		if (centers.empty()) {
+			for (size_t k = 0; k < n + 3; ++k)
+				nodes[k] = l0 + k * (ln - l0) / n;
+			return nodes;
+		}
+
+		auto density = [&](double s) {
+			double bump = 0;
+			for (double c : centers)
+				bump = std::max(bump, std::exp(-(s - c) * (s - c) / (cluster_width * cluster_width)));
+			return 1 + (cluster_ratio - 1) * bump;
+		};
+
+		// the integral by the trapezoidal rule, many samples per cell and per bump
+		size_t samples = (size_t) std::max(64.0 * n, std::min(16 * (ln - l0) / cluster_width, 4e6));
+		double h = (ln - l0) / samples;
+		std::vector<double> integral(samples + 1, 0.0);
+		for (size_t q = 1; q <= samples; ++q)
+			integral[q] = integral[q - 1] + (density(l0 + (q - 1) * h) + density(l0 + q * h)) * h / 2;
+
+		size_t q = 0;
+		for (size_t k = 1; k < n; ++k) {
+			double target = integral[samples] * k / n;
+			while (q + 1 < samples && integral[q + 1] < target)
+				++q;
+			nodes[k] = l0 + (q + (target - integral[q]) / (integral[q + 1] - integral[q])) * h;
+		}
+		nodes[0] = l0;
+		nodes[n] = ln;
+		nodes[n + 1] = 2 * nodes[n] - nodes[n - 1];
+		nodes[n + 2] = 3 * nodes[n] - 2 * nodes[n - 1];
+		return nodes;
+	}
+
+	// the stretched grid of the rows [row0, row0 + rows + 2) over the nodes ax and ay of the axes, see stretched_grid_t
+	static void lowerGrid(stretched_grid_t& grid, const std::vector<double>& ax, const std::vector<double>& ay,
+						  size_t row0, size_t rows) {
+		size_t Ny = ay.size() - 3;
+
+		// the factors of node k of the nodes of an axis, the first node mirrors its next neighbour
+		auto factors = [](const std::vector<double>& c, size_t k, double& m, double& p) {
+			double hm = k > 0 ? c[k] - c[k - 1] : c[k + 1] - c[k], hp = c[k + 1] - c[k];
+			m = 2 / (hm * (hm + hp));
+			p = 2 / (hp * (hm + hp));
+		};
+
+		grid.rows = rows;
+		grid.row0 = row0;
+		grid.x.assign(ax.begin() + row0, ax.begin() + row0 + rows + 2);
+		grid.y.assign(ay.begin(), ay.begin() + Ny + 2);
+		grid.xm.resize(rows + 2);
+		grid.xp.resize(rows + 2);
+		grid.ym.resize(Ny + 2);
+		grid.yp.resize(Ny + 2);
+		for (size_t i = 0; i < rows + 2; ++i)
+			factors(ax, row0 + i, grid.xm[i], grid.xp[i]);
+		for (size_t j = 0; j < Ny + 2; ++j)
+			factors(ay, j, grid.ym[j], grid.yp[j]);
+	}
+
+	// the domain, time step and borders of the problem, all initMatrix needs on a uniform grid
+	template <typename P>
+	void lowerBorders(P& problem) const {
+		problem.lx0 = lx0;
+		problem.lxn = lxn;
+		problem.ly0 = ly0;
+		problem.lyn = lyn;
+		problem.dt = dt;
+		problem.boundary = {left, right, bottom, top, initial};
+	}
+
+	// the problem for the rows [row0, row0 + rows + 2) of a grid of Nx x Ny cells with its border, all of them when rows
+	// is 0. the faces are the means of the conductivity of their two cells, at the coordinates the kernels use. on a
+	// stretched grid the nodes gather around the cluster coordinates, on a uniform one these are ignored
+	template <typename data_t, typename G>
+	void lower(config_problem_t<data_t, G>& problem, size_t Nx, size_t Ny, size_t row0 = 0, size_t rows = 0) const {
+		if (rows == 0)
+			rows = Nx;
+
+		lowerBorders(problem);
+
+		data_t dx = (data_t)(lxn - lx0) / (data_t)Nx;
+		data_t dy = (data_t)(lyn - ly0) / (data_t)Ny;
+		std::vector<double> ax, ay;
+		if constexpr (!G::is_uniform) {
+			ax = axis(lx0, lxn, Nx, cluster_x);
+			ay = axis(ly0, lyn, Ny, cluster_y);
+			lowerGrid(problem.grid, ax, ay, row0, rows);
+		}
+		auto X = [&](size_t i) {if constexpr (G::is_uniform) return data_t(lx0 + i * dx); else return data_t(ax[i]);};
+		auto Y = [&](size_t j) {if constexpr (G::is_uniform) return data_t(ly0 + j * dy); else return data_t(ay[j]);};
+
+		// the cells once, with one more row and column for the faces of the last ones: the map resampled over them or
+		// the conductivity, with the patches on top
+		size_t stride = Ny + 2;
+		std::vector<double> xs(rows + 3), ys(stride + 1), cells;
+		for (size_t i = 0; i < rows + 3; ++i)
+			xs[i] = X(row0 + i);
+		for (size_t j = 0; j < stride + 1; ++j)
+			ys[j] = Y(j);
+		if (map)
+			map->resample(xs, ys, lx0, lxn, ly0, lyn, cells);
+		else
+			cells.assign(xs.size() * ys.size(), conductivity);
+		for (size_t i = 0; i < rows + 3; ++i)
+			for (size_t j = 0; j < stride + 1; ++j)
+				cells[i * (stride + 1) + j] = lambda(xs[i], ys[j], cells[i * (stride + 1) + j]);
+		auto cell = [&](size_t i, size_t j) {return cells[i * (stride + 1) + j];};
+
+		face_conductivity_t<data_t>& faces = problem.conductivity;
+		faces.rows = rows;
+		faces.row0 = row0;
+		faces.stride = stride;
+		faces.x.resize((rows + 2) * stride);
+		faces.y.resize((rows + 2) * stride);
+		for (size_t i = 0; i < rows + 2; ++i) {
+			for (size_t j = 0; j < stride; ++j) {
+				faces.x[i * stride + j] = (data_t)(cell(i + 1, j) + cell(i, j)) / 2;
+				faces.y[i * stride + j] = (data_t)(cell(i, j + 1) + cell(i, j)) / 2;
+			}
+		}
+	}
+};
+
+#endif //TDMA_CONFIG_H
@@ -0,0 +1,280 @@
+#ifndef TDMA_COUNTERS_H
+#define TDMA_COUNTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <vector>
+
+/*
+ * Hardware counters of the phases of a time step, per OpenMP thread, read with perf_event_open:
+ *		cycles, instructions		IPC
+ *		llc misses					the lines the phase brought from memory, 64 bytes each: a lower bound of its traffic
+ *									(write backs are not counted)
+ *		dtlb misses					load misses of the data TLB
+ *		fp vector ops				packed floating point instructions, FP_ARITH_INST_RETIRED on Intel. other cpus need
+ *									their raw event in TDMA_FP_EVENT (the perf config in hex, e.g. 0x3 on AMD Zen)
+ *
+ * a thread opens its own events the first time it calls begin(), they only count that thread in user space. every
+ * event is opened on its own, so the ones the cpu or the kernel (perf_event_paranoid, a VM) do not provide are reported
+ * as n/a and the others still count. counts are scaled by time_enabled / time_running when the kernel multiplexes them.
+ *
+ * report() places each phase on a roofline: the flops of the phase (given by the app as flops per cell, the counters
+ * cannot count scalar operations portably) over the bytes the llc misses moved, against the memory bandwidth and the
+ * compute peak of the machine. a phase far below both roofs with a low IPC waits on the latency of its loads.
+ */
+
+enum counter_kind_t { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_LLC_MISSES, COUNTER_DTLB_MISSES, COUNTER_FP_VECTOR,
+					  COUNTER_COUNT };
+inline const char* counter_names[] = {"cycles", "instructions", "llc misses", "dtlb misses", "fp vector ops"};
+
+#define COUNTER_LINE 64
+
+// the events of one thread
+struct thread_counters_t {
+	int fd[COUNTER_COUNT];
+	bool opened = false;
+	double start[COUNTER_COUNT];
+	double started;
+
+	static int openEvent(uint32_t type, uint64_t config) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	void open() {
+		fd[COUNTER_CYCLES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		fd[COUNTER_INSTRUCTIONS] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fd[COUNTER_LLC_MISSES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		fd[COUNTER_DTLB_MISSES] = openEvent(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+											(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+		// event 0xc7 with the umasks of the 128, 256 and 512 bit packed single and double instructions
+		const char* fp = getenv("TDMA_FP_EVENT");
+		if (fp)
+			fd[COUNTER_FP_VECTOR] = openEvent(PERF_TYPE_RAW, strtoull(fp, nullptr, 16));
+		else if (__builtin_cpu_is("intel"))
+			fd[COUNTER_FP_VECTOR] = openEvent(PERF_TYPE_RAW, 0xfcc7);
+		else
+			fd[COUNTER_FP_VECTOR] = -1;
+		opened = true;
+	}
+
+	void close() {
+		for (int c = 0; c < COUNTER_COUNT; ++c)
+			if (opened && fd[c] >= 0)
+				::close(fd[c]);
+		opened = false;
+	}
+
+	// the current values, scaled when the event did not run all the time it was enabled
+	void read(double* values) {
+		for (int c = 0; c < COUNTER_COUNT; ++c) {
+			uint64_t v[3] = {0, 0, 0};
+			if (fd[c] < 0 || ::read(fd[c], v, sizeof(v)) != sizeof(v)) {
+				values[c] = 0;
+				continue;
+			}
+			values[c] = v[2] > 0 ? v[0] * ((double) v[1] / v[2]) : 0;
+		}
+	}
+};
+
+struct counters_t {
+	bool enabled = false;
+	std::vector<const char*> names;
+	std::vector<double> flops;
+
+	// one per thread, on their own cache lines since every thread writes its own
+	struct alignas(64) slot_t {
+		thread_counters_t events;
+	};
+	std::vector<slot_t> threads;
+
+	// [phase][thread][counter] and [phase][thread]
+	std::vector<double> totals, seconds;
+	std::vector<double> cells;
+	size_t steps = 0;
+
+	static double now() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// the phases with the flops each of them does per cell, for the roofline
+	void init(const std::vector<const char*>& phases, const std::vector<double>& flops_per_cell, int nthreads) {
+		release();
+		names = phases;
+		flops = flops_per_cell;
+		flops.resize(names.size(), 0.0);
+		threads = std::vector<slot_t>(std::max(nthreads, 1));
+		reset();
+		enabled = true;
+	}
+
+	void reset() {
+		totals.assign(names.size() * threads.size() * COUNTER_COUNT, 0.0);
+		seconds.assign(names.size() * threads.size(), 0.0);
+		cells.assign(names.size(), 0.0);
+		steps = 0;
+	}
+
+	void release() {
+		for (auto& t : threads)
+			t.events.close();
+		enabled = false;
+	}
+
+	// called by a thread when it enters a phase
+	void begin(int thread) {
+		if (!enabled) return;
+		thread_counters_t& t = threads[thread].events;
+		if (!t.opened)
+			t.open();
+		t.read(t.start);
+		t.started = now();
+	}
+
+	// and when it leaves it, the counts in between go to the phase
+	void end(int thread, int phase) {
+		if (!enabled) return;
+		thread_counters_t& t = threads[thread].events;
+		double values[COUNTER_COUNT];
+		t.read(values);
+		double* sum = &totals[(phase * threads.size() + thread) * COUNTER_COUNT];
+		for (int c = 0; c < COUNTER_COUNT; ++c)
+			sum[c] += values[c] - t.start[c];
+		seconds[phase * threads.size() + thread] += now() - t.started;
+	}
+
+	// the cells a phase processed, added once per step by the calling thread
+	void addCells(int phase, double n) {
+		if (enabled) cells[phase] += n;
+	}
+
+	void step() {
+		if (enabled) ++steps;
+	}
+
+	bool available(int counter) const {
+		for (auto& t : threads)
+			if (t.events.opened && t.events.fd[counter] >= 0)
+				return true;
+		return false;
+	}
+
+	double total(int phase, int counter) const {
+		double sum = 0;
+		for (size_t t = 0; t < threads.size(); ++t)
+			sum += totals[(phase * threads.size() + t) * COUNTER_COUNT + counter];
+		return sum;
+	}
+
+	// the wall time of a phase is the one of its slowest thread, the others wait for it at the barrier
+	double wall(int phase) const {
+		double w = 0;
+		for (size_t t = 0; t < threads.size(); ++t)
+			w = std::max(w, seconds[phase * threads.size() + t]);
+		return w;
+	}
+
+	// instructions per cycle of a phase, NAN when the events are not available
+	double ipc(int phase) const {
+		double c = total(phase, COUNTER_CYCLES);
+		if (!available(COUNTER_CYCLES) || !available(COUNTER_INSTRUCTIONS) || c <= 0) return NAN;
+		return total(phase, COUNTER_INSTRUCTIONS) / c;
+	}
+
+	// the count of an event per cell of a phase, NAN when the event is not available
+	double perCell(int phase, int counter) const {
+		if (!available(counter) || cells[phase] <= 0) return NAN;
+		return total(phase, counter) / cells[phase];
+	}
+
+	// the bytes a phase moved per cell, from its llc misses
+	double bytesPerCell(int phase) const {return perCell(phase, COUNTER_LLC_MISSES) * COUNTER_LINE;}
+
+	// per phase: ipc, bytes per cell, misses and vector ops per cell, the achieved bandwidth and flops, the arithmetic
+	// intensity and the percentage of the roof above it. peak_gflops 0 leaves out the compute roof
+	void report(FILE* f, double peak_gbs, double peak_gflops) const {
+		auto col = [](double v, const char* fmt, char* buf) {
+			if (std::isnan(v)) snprintf(buf, 16, "n/a");
+			else snprintf(buf, 16, fmt, v);
+			return buf;
+		};
+
+		fprintf(f, "counters over %zu steps, %zu threads, bandwidth roof %.1f GB/s", steps, threads.size(), peak_gbs);
+		if (peak_gflops > 0) fprintf(f, ", compute roof %.1f GFLOP/s", peak_gflops);
+		fprintf(f, "\n");
+		for (int c = 0; c < COUNTER_COUNT; ++c)
+			if (!available(c))
+				fprintf(f, "  %s: n/a, the event could not be opened\n", counter_names[c]);
+
+		fprintf(f, "%-14s %9s %7s %8s %9s %10s %10s %8s %8s %8s %7s\n", "phase", "ms/step", "ipc", "B/cell", "llc/cell",
+				"dtlb/cell", "fpvec/cell", "GB/s", "flop/B", "GFLOP/s", "roof %");
+		for (size_t p = 0; p < names.size(); ++p) {
+			char b[10][16];
+			double w = wall(p), n = cells[p];
+			double bytes = bytesPerCell(p) * n;
+			double gflops = w > 0 ? flops[p] * n / w * 1e-9 : NAN;
+
+			// the roof above the phase: the bandwidth times its intensity, capped by the compute peak
+			double intensity = bytes > 0 && flops[p] > 0 ? flops[p] * n / bytes : NAN;
+			double roof = peak_gbs * intensity;
+			if (peak_gflops > 0) roof = std::min(roof, peak_gflops);
+
+			fprintf(f, "%-14s %9.3f %7s %8s %9s %10s %10s %8s %8s %8s %7s\n", names[p], steps ? 1e3 * w / steps : 0.0,
+					col(ipc(p), "%.3f", b[0]), col(bytesPerCell(p), "%.3f", b[1]),
+					col(perCell(p, COUNTER_LLC_MISSES), "%.4f", b[2]), col(perCell(p, COUNTER_DTLB_MISSES), "%.4f", b[3]),
+					col(perCell(p, COUNTER_FP_VECTOR), "%.3f", b[4]), col(w > 0 ? bytes / w * 1e-9 : NAN, "%.2f", b[5]),
+					col(intensity, "%.3g", b[6]), col(gflops, "%.3f", b[7]), col(100 * gflops / roof, "%.1f", b[8]));
+		}
+
+		if (!available(COUNTER_CYCLES) || !available(COUNTER_INSTRUCTIONS) || threads.size() < 2) return;
+		fprintf(f, "ipc per thread\n");
+		for (size_t p = 0; p < names.size(); ++p) {
+			fprintf(f, "%-14s", names[p]);
+			for (size_t t = 0; t < threads.size(); ++t) {
+				const double* sum = &totals[(p * threads.size() + t) * COUNTER_COUNT];
+				fprintf(f, " %6.3f", sum[COUNTER_CYCLES] > 0 ? sum[COUNTER_INSTRUCTIONS] / sum[COUNTER_CYCLES] : 0.0);
+			}
+			fprintf(f, "\n");
+		}
+	}
+};
+
+// the bandwidth of a triad over arrays far larger than the caches, on the threads of the omp team, in GB/s
+inline double triadBandwidth(size_t n = (size_t) 1 << 25, int reps = 5) {
+	std::vector<double> a(n), b(n, 1.0), c(n, 2.0);
+	double best = 0;
+
+#pragma omp parallel for
+	for (size_t k = 0; k < n; ++k)
+		a[k] = 0;
+
+	for (int r = 0; r < reps; ++r) {
+		double t = counters_t::now();
+#pragma omp parallel for
+		for (size_t k = 0; k < n; ++k)
+			a[k] = b[k] + 3.0 * c[k];
+		t = counters_t::now() - t;
+		best = std::max(best, 3.0 * n * sizeof(double) / t * 1e-9);
+	}
+	return best;
+}
+
+#endif //TDMA_COUNTERS_H
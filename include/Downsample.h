@@ -0,0 +1,119 @@
+#ifndef TDMA_DOWNSAMPLE_H
+#define TDMA_DOWNSAMPLE_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "Matrix.h"
+
+// what a block of cells is reduced to
+enum reduce_t { REDUCE_MEAN, REDUCE_MIN, REDUCE_MAX };
+
+/*
+ * Every block of fx x fy cells keeps two partial values, so that the blocks reduced from different row ranges
+ * (slabs of different ranks, or chunks of different threads) can be merged afterwards:
+ *		REDUCE_MEAN				the sum and the count of the cells
+ *		REDUCE_MIN, REDUCE_MAX	the min and the max of the cells
+ *
+ * the blocks are aligned on the global rows, row0 being the global index of the row 0 of M,
+ * and the columns of M include its border.
+ */
+
+// number of blocks of f cells needed to cover n cells
+inline size_t blockCount(size_t n, size_t f) {return (n + f - 1) / f;}
+
+// fill the partial values of nb blocks with the neutral element of the reduction
+template <typename T>
+void initBlocks(T* part, size_t nb, reduce_t op) {
+	for (size_t b = 0; b < nb; ++b) {
+		part[2 * b] = op == REDUCE_MEAN ? 0 : std::numeric_limits<T>::max();
+		part[2 * b + 1] = op == REDUCE_MEAN ? 0 : std::numeric_limits<T>::lowest();
+	}
+}
+
+// reduce the rows [i0, i1) of M into the block rows (row0 + i0) / fx ... (row0 + i1 - 1) / fx of part
+template <typename T>
+void reduceBlocks(const matrix_t<T>& M, size_t i0, size_t i1, size_t row0, size_t fx, size_t fy, reduce_t op, T* part) {
+	size_t cols = M.M() + 2;
+	size_t by = blockCount(cols, fy);
+	size_t b0 = (row0 + i0) / fx;
+	size_t b1 = (row0 + i1 - 1) / fx;
+
+	initBlocks(part, (b1 - b0 + 1) * by, op);
+
+	// a block row is only ever touched by one thread
+#pragma omp parallel for schedule(static)
+	for (size_t b = b0; b <= b1; ++b) {
+		size_t lo = std::max(b * fx, row0 + i0) - row0;
+		size_t hi = std::min((b + 1) * fx, row0 + i1) - row0;
+		T* out = part + 2 * (b - b0) * by;
+
+		for (size_t i = lo; i < hi; ++i) {
+			const T* row = M[i];
+			for (size_t c = 0; c < by; ++c) {
+				size_t j1 = std::min((c + 1) * fy, cols);
+				T a = out[2 * c], z = out[2 * c + 1];
+				for (size_t j = c * fy; j < j1; ++j) {
+					if (op == REDUCE_MEAN) {
+						a += row[j];
+					} else {
+						a = std::min(a, row[j]);
+						z = std::max(z, row[j]);
+					}
+				}
+				out[2 * c] = a;
+				out[2 * c + 1] = op == REDUCE_MEAN ? z + (j1 - c * fy) : z;
+			}
+		}
+	}
+}
+
+// merge nb blocks of partial values into acc
+template <typename T>
+void mergeBlocks(const T* part, T* acc, size_t nb, reduce_t op) {
+	for (size_t b = 0; b < nb; ++b) {
+		if (op == REDUCE_MEAN) {
+			acc[2 * b] += part[2 * b];
+			acc[2 * b + 1] += part[2 * b + 1];
+		} else {
+			acc[2 * b] = std::min(acc[2 * b], part[2 * b]);
+			acc[2 * b + 1] = std::max(acc[2 * b + 1], part[2 * b + 1]);
+		}
+	}
+}
+
+// turn bx x by blocks of partial values into the reduced values, V covers the border as well
+template <typename T>
+void finishBlocks(const T* part, size_t bx, size_t by, reduce_t op, matrix_t<T>& V) {
+	V.init(bx - 2, by - 2);
+
+	for (size_t i = 0; i < bx; ++i) {
+		for (size_t j = 0; j < by; ++j) {
+			const T* p = part + 2 * (i * by + j);
+			if (op == REDUCE_MEAN)
+				V[i][j] = p[1] > 0 ? p[0] / p[1] : 0;
+			else
+				V[i][j] = op == REDUCE_MIN ? p[0] : p[1];
+		}
+	}
+}
+
+// reduce the whole of M (with its border) to at most w x h cells into V, part is the scratch space of the blocks.
+// returns false and leaves V alone when M already fits, M can then be drawn as it is
+template <typename T>
+bool downsample(const matrix_t<T>& M, size_t w, size_t h, reduce_t op, matrix_t<T>& V, std::vector<T>& part) {
+	size_t rows = M.N() + 2, cols = M.M() + 2;
+	size_t fx = blockCount(rows, std::max<size_t>(w, 8)), fy = blockCount(cols, std::max<size_t>(h, 8));
+	if (fx == 1 && fy == 1)
+		return false;
+
+	size_t bx = blockCount(rows, fx), by = blockCount(cols, fy);
+	part.resize(bx * by * 2);
+	reduceBlocks(M, 0, rows, 0, fx, fy, op, part.data());
+	finishBlocks(part.data(), bx, by, op, V);
+	return true;
+}
+
+#endif //TDMA_DOWNSAMPLE_H
@@ -0,0 +1,288 @@
+#ifndef TDMA_ENSEMBLE_H
+#define TDMA_ENSEMBLE_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+#include "Matrix.h"
+#include "Heat2d.h"
+
+/*
+ * K runs of one plate that differ in their borders, initial values or time step, stepped together. the fields are
+ * stored as an array of blocks of L members interleaved per cell (AoSoA): the L values of a cell are contiguous, so the
+ * sweeps solve the same line of L members in the lanes of a vector, and the coefficients of the line (the conductivity
+ * of the faces) are loaded once for all of them. only the time step differs between the lanes of a coefficient.
+ *
+ * L is a cache line of values, 16 floats: one AVX-512 vector or two AVX2 ones. the lanes of the last block past K
+ * repeat the last member. a member follows exactly the arithmetic of the 2d kernels, it gives the same field as a run
+ * of its own.
+ */
+
+// the rows and columns solved together by the column sweep, ENSEMBLE_COLS columns of L lanes
+#define ENSEMBLE_COLS 4
+
+template <typename T, size_t L = 64 / sizeof(T)>
+struct ensemble_t {
+	static constexpr size_t lanes = L;
+
+	size_t K = 0, blocks = 0;
+	std::vector<T> cells;
+
+	// the time step of every lane
+	std::vector<T> dt;
+
+private:
+	size_t _N = 0, _M = 0;
+
+public:
+	void init(size_t members, size_t N, size_t M) {
+		K = members;
+		blocks = (K + L - 1) / L;
+		_N = N;
+		_M = M;
+		cells.assign(blocks * (N + 2) * (M + 2) * L, T(0));
+		dt.assign(blocks * L, T(1));
+	}
+
+	size_t N() const {return _N;}
+	size_t M() const {return _M;}
+
+	// row i of block b, the L lanes of its cell j at j * L
+	T* row(size_t b, size_t i) {return cells.data() + (b * (_N + 2) + i) * (_M + 2) * L;}
+	const T* row(size_t b, size_t i) const {return cells.data() + (b * (_N + 2) + i) * (_M + 2) * L;}
+
+	// the field and the time step of member k, the last member fills the lanes past K as well
+	void set(size_t k, const matrix_t<T>& A, T step) {
+		size_t b = k / L, last = k + 1 == K ? L : k % L + 1;
+		for (size_t l = k % L; l < last; ++l) {
+			dt[b * L + l] = step;
+			for (size_t i = 0; i < _N + 2; ++i) {
+				T* dst = row(b, i) + l;
+				const T* src = A[i];
+				for (size_t j = 0; j < _M + 2; ++j)
+					dst[j * L] = src[j];
+			}
+		}
+	}
+
+	void get(size_t k, matrix_t<T>& A) const {
+		A.init(_N, _M);
+		size_t b = k / L, l = k % L;
+		for (size_t i = 0; i < _N + 2; ++i) {
+			const T* src = row(b, i) + l;
+			T* dst = A[i];
+			for (size_t j = 0; j < _M + 2; ++j)
+				dst[j] = src[j * L];
+		}
+	}
+};
+
+// a row of block b of the members of E into E2, the row sweep of calculateFixRow with the members in the lanes
+template <typename P, typename data_t, size_t L>
+void calculateFixRowLanes(const P& problem, ensemble_t<data_t, L>& E, size_t b, int row, ensemble_t<data_t, L>& E2,
+						  std::vector<data_t>& work) {
+
+	const data_t* dt = E.dt.data() + b * L;
+
+	work.resize(2 * (E.M() + 2) * L);
+	data_t* v_alph = work.data();
+	data_t* v_beta = v_alph + (E.M() + 2) * L;
+
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / E.N();
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / E.M();
+	auto X = [&](int i) {return nodeX(problem, dx, i);};
+	auto Y = [&](int j) {return nodeY(problem, dy, j);};
+
+	auto lpi2 = [&](int j) {return faceConductivity(problem, X, Y, row + 1, j, row, j);};
+	auto lmi2 = [&](int j) {return faceConductivity(problem, X, Y, row - 1, j, row, j);};
+	auto lpj2 = [&](int j) {return faceConductivity(problem, X, Y, row, j + 1, row, j);};
+	auto lmj2 = [&](int j) {return faceConductivity(problem, X, Y, row, j - 1, row, j);};
+
+	const data_t* prev = E.row(b, row - 1);
+	const data_t* cur = E.row(b, row);
+	const data_t* next = E.row(b, row + 1);
+	data_t* out = E2.row(b, row);
+
+	for (size_t l = 0; l < L; ++l) {
+		v_alph[l] = 0.0f;
+		v_beta[l] = cur[l];
+	}
+
+	// forward substitution, the coefficients of a cell once for the lanes
+	for (size_t j = 1; j < E.M() + 2; ++j) {
+		data_t Ai, Bi;
+		if constexpr (P::is_uniform_grid) {
+			Ai = (data_t)(- lmj2(j) / (2 * dy * dy));
+			Bi = (data_t)(- lpj2(j) / (2 * dy * dy));
+		} else {
+			Ai = (data_t)(- lmj2(j) * problem.grid.ym[j] / 2);
+			Bi = (data_t)(- lpj2(j) * problem.grid.yp[j] / 2);
+		}
+		data_t lp = lpi2(j), lm = lmi2(j);
+		double source = 0;
+		if constexpr (P::has_source)
+			source = problem.source(X(row), Y(j)) / 2;
+		(void) source;
+
+		const data_t* m = cur + j * L;
+		const data_t* down = prev + j * L;
+		const data_t* up = next + j * L;
+		const data_t* prev_alph = v_alph + (j - 1) * L;
+		const data_t* prev_beta = v_beta + (j - 1) * L;
+		data_t* alph = v_alph + j * L;
+		data_t* beta = v_beta + j * L;
+#pragma omp simd
+		for (size_t l = 0; l < L; ++l) {
+			data_t Ci = (data_t)((1 / dt[l] - Ai - Bi));
+			double d1 = lp * (up[l] - m[l]);
+			double d2 = lm * (m[l] - down[l]);
+			double d3 = m[l] / dt[l];
+			if constexpr (P::has_source)
+				d3 += source;
+			data_t Di;
+			if constexpr (P::is_uniform_grid)
+				Di = (data_t)(d3 + (d1 - d2) / (2 * dx * dx));
+			else
+				Di = (data_t)(d3 + (d1 * problem.grid.xp[row] - d2 * problem.grid.xm[row]) / 2);
+			alph[l] = - Bi / (Ci + Ai * prev_alph[l]);
+			beta[l] = (- Ai * prev_beta[l] + Di) / (Ci + Ai * prev_alph[l]);
+		}
+	}
+
+	// backward substitution
+	for (size_t j = E.M(); j > 0; --j) {
+		const data_t* alph = v_alph + j * L;
+		const data_t* beta = v_beta + j * L;
+		const data_t* right = out + (j + 1) * L;
+		data_t* o = out + j * L;
+#pragma omp simd
+		for (size_t l = 0; l < L; ++l)
+			o[l] = alph[l] * right[l] + beta[l];
+	}
+}
+
+// the columns [col0, col1) of block b of the members of E into E2, the column sweep of calculateFixCols with the
+// columns and the members in the lanes. a row of the block is contiguous, (col1 - col0) * L values
+template <typename P, typename data_t, size_t L>
+void calculateFixColsLanes(const P& problem, ensemble_t<data_t, L>& E, size_t b, size_t col0, size_t col1,
+						   ensemble_t<data_t, L>& E2, std::vector<data_t>& work) {
+
+	const data_t* dt = E.dt.data() + b * L;
+
+	size_t w = (col1 - col0) * L;
+	work.resize(2 * (E.N() + 2) * w);
+	data_t* v_alph = work.data();
+	data_t* v_beta = v_alph + (E.N() + 2) * w;
+
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / E.N();
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / E.M();
+	auto X = [&](int i) {return nodeX(problem, dx, i);};
+	auto Y = [&](int j) {return nodeY(problem, dy, j);};
+
+	auto lpi2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i + 1, col, i, col);};
+	auto lmi2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i - 1, col, i, col);};
+	auto lpj2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i, col + 1, i, col);};
+	auto lmj2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i, col - 1, i, col);};
+
+	const data_t* first = E.row(b, 0) + col0 * L;
+	for (size_t c = 0; c < w; ++c) {
+		v_alph[c] = 0.0f;
+		v_beta[c] = first[c];
+	}
+
+	// forward substitution, column by column of the block with its members in the lanes
+	for (size_t i = 1; i < E.N() + 2; ++i) {
+		for (size_t col = col0; col < col1; ++col) {
+			data_t Ai, Bi;
+			if constexpr (P::is_uniform_grid) {
+				Ai = (data_t)(-lmi2(i, col) / (2 * dx * dx));
+				Bi = (data_t)(-lpi2(i, col) / (2 * dx * dx));
+			} else {
+				Ai = (data_t)(-lmi2(i, col) * problem.grid.xm[i] / 2);
+				Bi = (data_t)(-lpi2(i, col) * problem.grid.xp[i] / 2);
+			}
+			data_t lp = lpj2(i, col), lm = lmj2(i, col);
+			double source = 0;
+			if constexpr (P::has_source)
+				source = problem.source(X(i), Y(col)) / 2;
+			(void) source;
+
+			size_t c = (col - col0) * L;
+			const data_t* m = E.row(b, i) + col * L;
+			const data_t* prev_alph = v_alph + (i - 1) * w + c;
+			const data_t* prev_beta = v_beta + (i - 1) * w + c;
+			data_t* alph = v_alph + i * w + c;
+			data_t* beta = v_beta + i * w + c;
+#pragma omp simd
+			for (size_t l = 0; l < L; ++l) {
+				data_t Ci = (data_t)((1 / dt[l]) - Ai - Bi);
+				double d1 = lp * (m[l + L] - m[l]);
+				double d2 = lm * (m[l] - m[l - L]);
+				double d3 = m[l] / dt[l];
+				if constexpr (P::has_source)
+					d3 += source;
+				data_t Di;
+				if constexpr (P::is_uniform_grid)
+					Di = (data_t)(d3 + (d1 - d2) / (2 * dy * dy));
+				else
+					Di = (data_t)(d3 + (d1 * problem.grid.yp[col] - d2 * problem.grid.ym[col]) / 2);
+				alph[l] = -Bi / (Ci + Ai * prev_alph[l]);
+				beta[l] = (Di - Ai * prev_beta[l]) / (Ci + Ai * prev_alph[l]);
+			}
+		}
+	}
+
+	// backward substitution
+	for (size_t i = E.N(); i > 0; --i) {
+		const data_t* alph = v_alph + i * w;
+		const data_t* beta = v_beta + i * w;
+		const data_t* next = E2.row(b, i + 1) + col0 * L;
+		data_t* out = E2.row(b, i) + col0 * L;
+#pragma omp simd
+		for (size_t c = 0; c < w; ++c)
+			out[c] = alph[c] * next[c] + beta[c];
+	}
+}
+
+// the rows of every block of E into E2, an orphaned worksharing loop like sweepRows
+template <typename P, typename data_t, size_t L>
+void sweepRowsLanesKernel(const P& problem, ensemble_t<data_t, L>& E, ensemble_t<data_t, L>& E2) {
+	TRACE_ZONE("ensemble row sweep batch");
+	std::vector<data_t> work;
+	size_t n = E.blocks * E.N();
+#pragma omp for nowait
+	for (size_t r = 0; r < n; ++r)
+		calculateFixRowLanes(problem, E, r / E.N(), 1 + r % E.N(), E2, work);
+}
+
+// the columns of every block of E2 into E, ENSEMBLE_COLS columns at a time
+template <typename P, typename data_t, size_t L>
+void sweepColsLanesKernel(const P& problem, ensemble_t<data_t, L>& E2, ensemble_t<data_t, L>& E) {
+	TRACE_ZONE("ensemble column sweep batch");
+	std::vector<data_t> work;
+	size_t per_block = (E2.M() + ENSEMBLE_COLS - 1) / ENSEMBLE_COLS;
+	size_t n = E2.blocks * per_block;
+#pragma omp for nowait
+	for (size_t r = 0; r < n; ++r) {
+		size_t j0 = 1 + (r % per_block) * ENSEMBLE_COLS;
+		calculateFixColsLanes(problem, E2, r / per_block, j0, std::min(j0 + ENSEMBLE_COLS, E2.M() + 1), E, work);
+	}
+}
+
+ISA_DISPATCH(sweepRowsLanes, sweepRowsLanesKernel)
+ISA_DISPATCH(sweepColsLanes, sweepColsLanesKernel)
+
+// one time step of every member of E, E2 holds the values between the row and the column sweeps
+template <typename P, typename data_t, size_t L>
+void adiStepLanes(const P& problem, ensemble_t<data_t, L>& E, ensemble_t<data_t, L>& E2) {
+	E2 = E;
+
+#pragma omp parallel
+	sweepRowsLanes(problem, E, E2);
+
+#pragma omp parallel
+	sweepColsLanes(problem, E2, E);
+}
+
+#endif //TDMA_ENSEMBLE_H
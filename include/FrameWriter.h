@@ -0,0 +1,309 @@
+#ifndef TDMA_FRAMEWRITER_H
+#define TDMA_FRAMEWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Matrix.h"
+#include "Trace.h"
+#include "Colormap.h"
+
+/*
+ * Frames of the field written to disk without a window or a gl context:
+ *		FRAME_PPM	one binary ppm (P6) per frame
+ *		FRAME_PNG	one png per frame, the image data is deflated with stored (uncompressed) blocks
+ *		FRAME_RAW	all frames appended to one stream of rgb24 pixels, to pipe into an encoder
+ *
+ * the images have the orientation of the plotters: the rows i of the matrix go to the right and the columns j go down.
+ * the solver only copies the field into a queue, the colorization and the encoding run on a writer thread. the queue is
+ * bounded, when the writer falls behind that much the solver waits for it (the time is reported as stalled) instead of
+ * dropping frames.
+ */
+
+enum frame_format_t { FRAME_PPM, FRAME_PNG, FRAME_RAW, FRAME_FORMATS };
+inline const char* frame_format_names[FRAME_FORMATS] = {"ppm", "png", "raw"};
+
+// crc32 of the png chunks, poly 0xedb88320
+inline uint32_t pngCrc(uint32_t crc, const unsigned char* p, size_t n) {
+	static const std::vector<uint32_t> table = [] {
+		std::vector<uint32_t> t(256);
+		for (uint32_t k = 0; k < 256; ++k) {
+			uint32_t c = k;
+			for (int b = 0; b < 8; ++b)
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			t[k] = c;
+		}
+		return t;
+	}();
+
+	crc = ~crc;
+	for (size_t k = 0; k < n; ++k)
+		crc = table[(crc ^ p[k]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline void writeBE32(FILE* f, uint32_t v) {
+	unsigned char b[4] = {(unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char) v};
+	fwrite(b, 1, 4, f);
+}
+
+inline void writeChunk(FILE* f, const char* type, const unsigned char* data, size_t n) {
+	writeBE32(f, n);
+	fwrite(type, 1, 4, f);
+	fwrite(data, 1, n, f);
+	writeBE32(f, pngCrc(pngCrc(0, (const unsigned char*) type, 4), data, n));
+}
+
+inline bool writePPM(FILE* f, const unsigned char* rgb, size_t w, size_t h) {
+	fprintf(f, "P6\n%zu %zu\n255\n", w, h);
+	return fwrite(rgb, 3, w * h, f) == w * h;
+}
+
+inline bool writePNG(FILE* f, const unsigned char* rgb, size_t w, size_t h) {
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	fwrite(signature, 1, 8, f);
+
+	unsigned char ihdr[13] = {
+		(unsigned char)(w >> 24), (unsigned char)(w >> 16), (unsigned char)(w >> 8), (unsigned char) w,
+		(unsigned char)(h >> 24), (unsigned char)(h >> 16), (unsigned char)(h >> 8), (unsigned char) h,
+		8, 2, 0, 0, 0};
+	writeChunk(f, "IHDR", ihdr, 13);
+
+	// the scanlines with their filter byte (none), wrapped in a zlib stream of stored blocks of at most 65535 bytes
+	size_t line = 3 * w + 1, raw = line * h;
+	std::vector<unsigned char> z;
+	z.reserve(raw + raw / 65535 * 5 + 5 + 6);
+	z.push_back(0x78);
+	z.push_back(0x01);
+
+	uint32_t a = 1, b = 0;
+	size_t pos = 0;
+	do {
+		size_t n = std::min<size_t>(raw - pos, 65535);
+		z.push_back(pos + n == raw);
+		z.push_back(n & 0xff);
+		z.push_back(n >> 8);
+		z.push_back(~n & 0xff);
+		z.push_back((~n >> 8) & 0xff);
+		for (size_t k = pos; k < pos + n; ++k) {
+			size_t x = k % line;
+			unsigned char c = x == 0 ? 0 : rgb[(k / line) * 3 * w + x - 1];
+			z.push_back(c);
+			a = (a + c) % 65521;
+			b = (b + a) % 65521;
+		}
+		pos += n;
+	} while (pos < raw);
+
+	uint32_t adler = (b << 16) | a;
+	for (int s = 24; s >= 0; s -= 8)
+		z.push_back((adler >> s) & 0xff);
+
+	writeChunk(f, "IDAT", z.data(), z.size());
+	writeChunk(f, "IEND", nullptr, 0);
+	return !ferror(f);
+}
+
+// the pattern of the frame names with its one integer conversion rewritten to take the long step (e.g. frame_%06d.png
+// becomes frame_%06ld.png) and %% kept, or an empty string when it has no conversion, more than one, or one that is
+// not of an integer: the pattern comes from the command line and is used as a format
+inline std::string stepPattern(const std::string& pattern) {
+	std::string out;
+	int conversions = 0;
+	for (size_t k = 0; k < pattern.size(); ++k) {
+		out += pattern[k];
+		if (pattern[k] != '%')
+			continue;
+		if (k + 1 < pattern.size() && pattern[k + 1] == '%') {
+			out += pattern[++k];
+			continue;
+		}
+
+		// flags, width and precision are kept, the length modifier is replaced by l
+		size_t e = k + 1;
+		while (e < pattern.size() && strchr("-+ #0", pattern[e]))
+			++e;
+		while (e < pattern.size() && pattern[e] >= '0' && pattern[e] <= '9')
+			++e;
+		if (e < pattern.size() && pattern[e] == '.')
+			for (++e; e < pattern.size() && pattern[e] >= '0' && pattern[e] <= '9';)
+				++e;
+		out.append(pattern, k + 1, e - k - 1);
+		while (e < pattern.size() && strchr("hljzt", pattern[e]))
+			++e;
+		if (e == pattern.size() || !strchr("diuoxX", pattern[e]) || ++conversions > 1)
+			return "";
+		out += 'l';
+		out += pattern[e];
+		k = e;
+	}
+	return conversions == 1 ? out : "";
+}
+
+template <typename T>
+struct frame_writer_t {
+
+	struct frame_t {
+		long step;
+		size_t rows, cols;
+		std::vector<T> data;
+	};
+
+	frame_format_t format = FRAME_PPM;
+	std::string out;
+	colormap_t cmap;
+	size_t capacity = 8;
+
+	std::deque<frame_t> queue;
+	std::vector<std::vector<T>> pool;
+	std::mutex mtx;
+	std::condition_variable pushed, popped;
+	std::thread worker;
+	bool running = false, closing = false;
+
+	FILE* stream = nullptr;
+	bool piped = false;
+	size_t written = 0, failed = 0;
+	double stalled = 0;
+
+	~frame_writer_t() {close();}
+
+	// start the writer thread. out is a printf pattern of the step with one integer conversion (e.g. frame_%06ld.png)
+	// for ppm and png, and a file or "|command" (the stdin of the command) for raw
+	bool open(frame_format_t fmt, const std::string& path, const colormap_t& colors, size_t depth) {
+		format = fmt;
+		out = format == FRAME_RAW ? path : stepPattern(path);
+		cmap = colors;
+		capacity = std::max<size_t>(depth, 1);
+
+		if (out.empty()) {
+			fprintf(stderr, "the frame names %s need one integer conversion of the step and no other, e.g. "
+					"frame_%%06ld.%s\n", path.c_str(), frame_format_names[format]);
+			return false;
+		}
+		if (format == FRAME_RAW) {
+			piped = !out.empty() && out[0] == '|';
+			stream = piped ? popen(out.c_str() + 1, "w") : fopen(out.c_str(), "wb");
+			if (!stream) {
+				fprintf(stderr, "cannot open %s for the frames\n", out.c_str());
+				return false;
+			}
+		}
+
+		closing = false;
+		running = true;
+		worker = std::thread(&frame_writer_t::run, this);
+		return true;
+	}
+
+	// queue a copy of M (with its border), waits only while the queue is full
+	void push(const matrix_t<T>& M, long step) {
+		if (!running) return;
+		size_t rows = M.N() + 2, cols = M.M() + 2;
+
+		std::unique_lock<std::mutex> lock(mtx);
+		if (queue.size() >= capacity) {
+			auto t = std::chrono::steady_clock::now();
+			popped.wait(lock, [&] {return queue.size() < capacity;});
+			stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+		}
+
+		std::vector<T> data;
+		if (!pool.empty()) {
+			data.swap(pool.back());
+			pool.pop_back();
+		}
+		lock.unlock();
+
+		data.resize(rows * cols);
+		memcpy(data.data(), M.data(), rows * cols * sizeof(T));
+
+		lock.lock();
+		queue.push_back({step, rows, cols, std::move(data)});
+		pushed.notify_one();
+	}
+
+	// write the frames still queued and stop the writer thread
+	void close() {
+		if (!running) return;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			closing = true;
+		}
+		pushed.notify_one();
+		worker.join();
+		running = false;
+
+		if (stream && piped)
+			pclose(stream);
+		else if (stream)
+			fclose(stream);
+		stream = nullptr;
+	}
+
+	void run() {
+		TRACE_THREAD("frame writer");
+		std::vector<ImU32> line;
+		std::vector<unsigned char> rgb;
+		bool announced = false;
+
+		for (;;) {
+			std::unique_lock<std::mutex> lock(mtx);
+			pushed.wait(lock, [&] {return closing || !queue.empty();});
+			if (queue.empty())
+				return;
+			frame_t frame = std::move(queue.front());
+			queue.pop_front();
+			popped.notify_one();
+			lock.unlock();
+			TRACE_ZONE("write frame");
+
+			// color the matrix rows and lay them out as image columns
+			size_t w = frame.rows, h = frame.cols;
+			line.resize(h);
+			rgb.resize(3 * w * h);
+			for (size_t i = 0; i < w; ++i) {
+				cmap.colorize(frame.data.data() + i * h, line.data(), h);
+				for (size_t j = 0; j < h; ++j) {
+					unsigned char* px = rgb.data() + 3 * (j * w + i);
+					px[0] = line[j] & 0xff;
+					px[1] = (line[j] >> 8) & 0xff;
+					px[2] = (line[j] >> 16) & 0xff;
+				}
+			}
+
+			bool ok;
+			if (format == FRAME_RAW) {
+				if (!announced)
+					fprintf(stderr, "raw frames: %zux%zu rgb24\n", w, h);
+				announced = true;
+				ok = fwrite(rgb.data(), 3, w * h, stream) == w * h;
+			} else {
+				char path[4096];
+				snprintf(path, sizeof(path), out.c_str(), frame.step);
+				FILE* f = fopen(path, "wb");
+				ok = f && (format == FRAME_PNG ? writePNG(f, rgb.data(), w, h) : writePPM(f, rgb.data(), w, h));
+				if (f)
+					ok = fclose(f) == 0 && ok;
+			}
+
+			lock.lock();
+			if (ok)
+				++written;
+			else
+				++failed;
+			pool.push_back(std::move(frame.data));
+		}
+	}
+};
+
+#endif //TDMA_FRAMEWRITER_H
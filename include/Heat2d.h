@@ -0,0 +1,343 @@
+#ifndef TDMA_HEAT2D_H
+#define TDMA_HEAT2D_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Matrix.h"
+#include "Isa.h"
+#include "Problem.h"
+#include "Trace.h"
+
+/*
+ * The 2 dimension heat problem of tdma_2d and its ADI kernels, shared by the plotter and the benchmarks.
+ *
+ * a step is the two halves of the Peaceman-Rachford scheme: the rows are solved implicitly along y with the differences
+ * along x taken explicitly from the field, then the columns implicitly along x with the differences along y from the
+ * rows. each half carries half of the operator in both directions, which keeps the step stable whatever dt and the
+ * spacing.
+ *
+ * the kernels are templates over the problem (see Problem.h) and the element type, the plate of tdma_2d is the problem
+ * the macros below define. the sweeps and the step change are dispatched to the instruction set of the cpu (see Isa.h),
+ * the columns are solved in blocks of SWEEP_BLOCK neighbours so that their recurrences run side by side in vector
+ * registers.
+ */
+
+// define the intervals for x and y
+#define LX0 0
+#define LXn 1.0f
+#define LY0 0
+#define LYn 0.5f
+
+// define the border values, the conductivity is without branches so that the sweeps of several columns vectorize
+#define LMD(x,y) ( ((x >= 0.25f) & (x <= 0.65f) & (y >= 0.1f) & (y <= 0.25f)) ? 1e-3 : 1e-4 )
+#define X0(y) (600)
+#define XN(y) (1200)
+#define Y0(x) (600 * (1 + x))
+#define YN(x) (600 * (1 + x * x))
+
+// define the initial values for the matrix
+#define FT0(x, y) 	(300)
+
+// define the increment of time delta_t
+#define DT 0.01f
+
+// the floating point operations of a row or a column sweep per cell, counted in calculateFixRow (the coefficients, the
+// forward and the backward substitution) for the roofline of the counters
+#define SWEEP_FLOPS 36
+
+// the columns solved together by calculateFixCols, a cache line of floats and a vector of 16 floats on AVX-512
+#define SWEEP_BLOCK 16
+
+// the plate of the macros above as a problem
+struct plate_conductivity_t {
+	static constexpr bool is_constant = false;
+	static constexpr bool is_tabulated = false;
+	template <typename T>
+	double operator()(T x, T y) const {return LMD(x, y);}
+};
+
+struct plate_boundary_t {
+	template <typename T> T x0(T y) const {(void) y; return X0(y);}
+	template <typename T> T xn(T y) const {(void) y; return XN(y);}
+	template <typename T> T y0(T x) const {return Y0(x);}
+	template <typename T> T yn(T x) const {return YN(x);}
+	template <typename T> T t0(T x, T y) const {(void) x; (void) y; return FT0(x, y);}
+};
+
+struct plate_problem_t : problem_t<plate_conductivity_t, plate_boundary_t> {
+	plate_problem_t() {
+		lx0 = LX0;
+		lxn = LXn;
+		ly0 = LY0;
+		lyn = LYn;
+		dt = DT;
+	}
+};
+
+// the plate with the same conductivity everywhere
+struct uniform_problem_t : problem_t<uniform_conductivity_t, plate_boundary_t> {
+	explicit uniform_problem_t(double lambda) {
+		lx0 = LX0;
+		lxn = LXn;
+		ly0 = LY0;
+		lyn = LYn;
+		dt = DT;
+		conductivity.value = lambda;
+	}
+};
+
+// the conductivity on the face between the neighbouring cells (ia, ja) and (ib, jb), at the coordinates X and Y: their
+// mean, the conductivity itself when it is uniform, or the face from the table the problem was lowered to
+template <typename P, typename FX, typename FY>
+auto faceConductivity(const P& problem, const FX& X, const FY& Y, int ia, int ja, int ib, int jb) {
+	using data_t = decltype(X(0));
+	if constexpr (P::is_tabulated_conductivity) {
+		return (data_t) problem.conductivity.face(ia, ja, ib, jb);
+	} else if constexpr (P::is_constant_conductivity) {
+		(void) ib; (void) jb;
+		return (data_t) problem.conductivity(X(ia), Y(ja));
+	} else {
+		return (data_t)(problem.conductivity(X(ia), Y(ja)) + problem.conductivity(X(ib), Y(jb))) / 2;
+	}
+}
+
+// the coordinate of the node i along x and of the node j along y, dx and dy apart on a uniform grid. the index keeps
+// the type of the caller, an int converts to the element type in the lanes of a vector
+template <typename P, typename data_t, typename I>
+data_t nodeX(const P& problem, data_t dx, I i) {
+	if constexpr (P::is_uniform_grid)
+		return data_t(problem.lx0 + (problem.grid.row0 + i) * dx);
+	else
+		return data_t(problem.grid.x[i]);
+}
+
+template <typename P, typename data_t, typename I>
+data_t nodeY(const P& problem, data_t dy, I j) {
+	if constexpr (P::is_uniform_grid)
+		return data_t(problem.ly0 + (problem.grid.col0 + j) * dy);
+	else
+		return data_t(problem.grid.y[j]);
+}
+
+// create a matrix and fill it with initial and border values
+template <typename P, typename data_t>
+void initMatrix(const P& problem, matrix_t<data_t>& M, size_t Nx, size_t Ny) {
+	TRACE_ZONE("initMatrix");
+
+	M.init(Nx, Ny);
+
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / (data_t)Nx;
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / (data_t)Ny;
+	auto X = [&](size_t i) {return nodeX(problem, dx, i);};
+	auto Y = [&](size_t j) {return nodeY(problem, dy, j);};
+
+
+	// fill in initial values for x = 0 and x = n
+	for (size_t i = 0; i < Ny + 2; ++i) {
+		M[0][i] = problem.boundary.x0(Y(i));
+		M[Nx + 1][i] = problem.boundary.xn(Y(i));
+	}
+
+	// fill in initial values for y = 0 and y = m
+	for (uint i = 1; i < M.N() + 1; ++i) {
+		M[i][0] = problem.boundary.y0(X(i));
+		M[i][Ny + 1] = problem.boundary.yn(X(i));
+	}
+
+	// fill in matrix with init values
+	for (size_t i = 1; i < Nx + 1; ++i) {
+		for (size_t j = 1; j < Ny + 1; ++j) {
+			M[i][j] = problem.boundary.t0(X(i), Y(j));
+		}
+	}
+}
+
+// calculate the values of a given row in the matrix
+template <typename P, typename data_t>
+void calculateFixRow(const P& problem, matrix_t<data_t>& M, int row, matrix_t<data_t>& M2) {
+
+	data_t dt = problem.dt;
+
+	std::vector<data_t> v_alph(M.M() + 2);
+	std::vector<data_t> v_beta(M.M() + 2);
+
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / M.N();
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / M.M();
+	auto X = [&](int i) {return nodeX(problem, dx, i);};
+	auto Y = [&](int j) {return nodeY(problem, dy, j);};
+
+	auto lpi2 = [&](int j) {return faceConductivity(problem, X, Y, row + 1, j, row, j);};
+	auto lmi2 = [&](int j) {return faceConductivity(problem, X, Y, row - 1, j, row, j);};
+	auto lpj2 = [&](int j) {return faceConductivity(problem, X, Y, row, j + 1, row, j);};
+	auto lmj2 = [&](int j) {return faceConductivity(problem, X, Y, row, j - 1, row, j);};
+
+	// on a stretched grid the faces are weighed by the factors of their node instead of 1 / (dx * dx)
+	auto Ai =  [&](int j) {
+		if constexpr (P::is_uniform_grid) return (data_t)(- lmj2(j) / (2 * dy * dy));
+		else return (data_t)(- lmj2(j) * problem.grid.ym[j] / 2); };
+	auto Bi =  [&](int j) {
+		if constexpr (P::is_uniform_grid) return (data_t)(- lpj2(j) / (2 * dy * dy));
+		else return (data_t)(- lpj2(j) * problem.grid.yp[j] / 2); };
+	auto Ci =  [&](int j) {return (data_t)((1 / dt - Ai(j) - Bi(j)));};
+	auto Di =  [&](int j) {
+		double d1 = lpi2(j) * (M[row + 1][j] - M[row][j]);
+		double d2 = lmi2(j) * (M[row][j] - M[row - 1][j]);
+		double d3 = M[row][j] / dt;
+		// each half step gets half of the source
+		if constexpr (P::has_source)
+			d3 += problem.source(X(row), Y(j)) / 2;
+		if constexpr (P::is_uniform_grid)
+			return (data_t)(d3 + (d1 - d2) / (2 * dx * dx));
+		else
+			return (data_t)(d3 + (d1 * problem.grid.xp[row] - d2 * problem.grid.xm[row]) / 2); };
+
+
+	v_alph[0] = 0.0f;
+	v_beta[0] = M[row][0];
+
+	// forward substitution
+	for (size_t i = 1; i < M.M() + 2; ++i) {
+		v_alph[i] = - Bi(i) / (Ci(i) + Ai(i) * v_alph[i - 1]);
+		v_beta[i] = (- Ai(i) * v_beta[i - 1] + Di(i)) / (Ci(i) + Ai(i) * v_alph[i - 1]);
+	}
+
+	// backward substitution
+	for (size_t i = M.M(); i > 0; --i) {
+		M2[row][i] = v_alph[i] * M2[row][i + 1] + v_beta[i];
+	}
+}
+
+// calculate the values of the columns [col0, col1) of the matrix. the columns are the inner loops, so that the loads are
+// contiguous and the recurrences of neighbouring columns run in the lanes of a vector.
+// work holds the coefficients of every row and column of the block
+template <typename P, typename data_t>
+void calculateFixCols(const P& problem, matrix_t<data_t>& M, size_t col0, size_t col1, matrix_t<data_t>& M2,
+					  std::vector<data_t>& work) {
+
+	data_t dt = problem.dt;
+
+	size_t w = col1 - col0;
+	work.resize(2 * (M.N() + 2) * w);
+	data_t* v_alph = work.data();
+	data_t* v_beta = v_alph + (M.N() + 2) * w;
+
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / M.N();
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / M.M();
+	auto X = [&](int i) {return nodeX(problem, dx, i);};
+	auto Y = [&](int j) {return nodeY(problem, dy, j);};
+
+	auto lpi2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i + 1, col, i, col);};
+	auto lmi2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i - 1, col, i, col);};
+	auto lpj2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i, col + 1, i, col);};
+	auto lmj2 = [&](int i, int col) {return faceConductivity(problem, X, Y, i, col - 1, i, col);};
+
+	auto Ai =  [&](int i, int col) {
+		if constexpr (P::is_uniform_grid) return (data_t)(-lmi2(i, col) / (2 * dx * dx));
+		else return (data_t)(-lmi2(i, col) * problem.grid.xm[i] / 2); };
+	auto Bi =  [&](int i, int col) {
+		if constexpr (P::is_uniform_grid) return (data_t)(-lpi2(i, col) / (2 * dx * dx));
+		else return (data_t)(-lpi2(i, col) * problem.grid.xp[i] / 2); };
+	auto Ci =  [&](int i, int col) {return (data_t)((1 / dt) - Ai(i, col) - Bi(i, col));};
+	auto Di =  [&](int i, int col) {
+		double d1 = lpj2(i, col) * (M[i][col + 1] - M[i][col]);
+		double d2 = lmj2(i, col) * (M[i][col] - M[i][col - 1]);
+		double d3 = M[i][col] / dt;
+		if constexpr (P::has_source)
+			d3 += problem.source(X(i), Y(col)) / 2;
+		if constexpr (P::is_uniform_grid)
+			return (data_t)(d3 + (d1 - d2) / (2 * dy * dy));
+		else
+			return (data_t)(d3 + (d1 * problem.grid.yp[col] - d2 * problem.grid.ym[col]) / 2); };
+
+
+	for (size_t c = 0; c < w; ++c) {
+		v_alph[c] = 0.0f;
+		v_beta[c] = M[0][col0 + c];
+	}
+
+	// forward substitution
+	for (size_t i = 1; i < M.N() + 2; ++i) {
+		data_t* alph = v_alph + i * w;
+		data_t* beta = v_beta + i * w;
+		const data_t* prev_alph = alph - w;
+		const data_t* prev_beta = beta - w;
+#pragma omp simd
+		for (size_t c = 0; c < w; ++c) {
+			int col = col0 + c;
+			alph[c] = -Bi(i, col) / (Ci(i, col) + Ai(i, col) * prev_alph[c]);
+			beta[c] = (Di(i, col) - Ai(i, col) * prev_beta[c]) / (Ci(i, col) + Ai(i, col) * prev_alph[c]);
+		}
+	}
+
+	// backward substitution
+	for (size_t i = M.N(); i > 0; --i) {
+		const data_t* alph = v_alph + i * w;
+		const data_t* beta = v_beta + i * w;
+		const data_t* next = M2[i + 1] + col0;
+		data_t* out = M2[i] + col0;
+#pragma omp simd
+		for (size_t c = 0; c < w; ++c)
+			out[c] = alph[c] * next[c] + beta[c];
+	}
+}
+
+// solve the rows of M into M2. an orphaned worksharing loop without a barrier at its end: inside a parallel region
+// the rows are shared among the threads, outside of one the calling thread solves them all
+template <typename P, typename data_t>
+void sweepRowsKernel(const P& problem, matrix_t<data_t>& M, matrix_t<data_t>& M2) {
+	TRACE_ZONE("row sweep batch");
+#pragma omp for nowait
+	for (size_t i = 1; i < M.N() + 1; ++i)
+		calculateFixRow(problem, M, i, M2);
+}
+
+// solve the columns of M2 into M, like sweepRows, SWEEP_BLOCK columns at a time
+template <typename P, typename data_t>
+void sweepColsKernel(const P& problem, matrix_t<data_t>& M2, matrix_t<data_t>& M) {
+	TRACE_ZONE("column sweep batch");
+	std::vector<data_t> work;
+	size_t blocks = (M2.M() + SWEEP_BLOCK - 1) / SWEEP_BLOCK;
+#pragma omp for nowait
+	for (size_t b = 0; b < blocks; ++b) {
+		size_t j0 = 1 + b * SWEEP_BLOCK;
+		calculateFixCols(problem, M2, j0, std::min(j0 + SWEEP_BLOCK, M2.M() + 1), M, work);
+	}
+}
+
+// the root mean square of the difference of the cells of A and B, how far a step moved the field. it is not the
+// residual of the equations: a field that changes slowly is not necessarily converged
+template <typename data_t>
+double stepChangeKernel(const matrix_t<data_t>& A, const matrix_t<data_t>& B) {
+	double sum = 0;
+	for (size_t i = 1; i < A.N() + 1; ++i) {
+		const data_t* a = A[i];
+		const data_t* b = B[i];
+#pragma omp simd reduction(+:sum)
+		for (size_t j = 1; j < A.M() + 1; ++j) {
+			double d = (double) a[j] - b[j];
+			sum += d * d;
+		}
+	}
+	return std::sqrt(sum / ((double) A.N() * A.M()));
+}
+
+ISA_DISPATCH(sweepRows, sweepRowsKernel)
+ISA_DISPATCH(sweepCols, sweepColsKernel)
+ISA_DISPATCH(stepChange, stepChangeKernel)
+
+// one time step of M, M2 holds the values between the row and the column sweeps
+template <typename P, typename data_t>
+void adiStep(const P& problem, matrix_t<data_t>& M, matrix_t<data_t>& M2) {
+	M2 = M;
+
+#pragma omp parallel
+	sweepRows(problem, M, M2);
+
+#pragma omp parallel
+	sweepCols(problem, M2, M);
+}
+
+#endif //TDMA_HEAT2D_H
@@ -0,0 +1,92 @@
+#ifndef TDMA_HEATMAP_H
+#define TDMA_HEATMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "imgui.h"
+#include <SDL2/SDL_opengl.h>
+
+#include "Matrix.h"
+#include "Colormap.h"
+
+/*
+ * The field drawn as one texture with a texel per cell, instead of a rectangle per cell.
+ *
+ * the texture keeps the memory layout of the matrix (a texture row per matrix row i, the columns j along it) so the
+ * colorization reads the matrix contiguously, and the quad it is drawn on swaps the axes: i goes to the right and j
+ * goes down, like the rectangles did.
+ */
+struct heatmap_t {
+
+	GLuint tex = 0;
+	size_t w = 0, h = 0;
+	std::vector<ImU32> pixels;
+
+	// convert the matrix with its border to pixels with color(value) and upload them
+	template <typename T, typename F>
+	void update(const matrix_t<T>& M, F color) {
+		size_t rows = M.N() + 2, cols = M.M() + 2;
+		pixels.resize(rows * cols);
+
+#pragma omp parallel for schedule(static)
+		for (size_t i = 0; i < rows; ++i) {
+			const T* src = M[i];
+			ImU32* dst = pixels.data() + i * cols;
+			for (size_t j = 0; j < cols; ++j)
+				dst[j] = color(src[j]);
+		}
+
+		upload(cols, rows);
+	}
+
+	// convert the matrix with its border to pixels through the lookup table of a colormap and upload them
+	template <typename T>
+	void update(const matrix_t<T>& M, const colormap_t& cmap) {
+		size_t rows = M.N() + 2, cols = M.M() + 2;
+		pixels.resize(rows * cols);
+		cmap.colorize(M, 0, rows, pixels.data());
+		upload(cols, rows);
+	}
+
+	// upload pixels, the texture is only reallocated when its size changes
+	void upload(size_t width, size_t height) {
+		if (tex == 0) {
+			glGenTextures(1, &tex);
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		if (width != w || height != h) {
+			w = width;
+			h = height;
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		} else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		}
+	}
+
+	// draw the texture on the rectangle [p0, p1], with the rows of the matrix from left to right
+	void draw(ImDrawList* dl, ImVec2 p0, ImVec2 p1) const {
+		if (tex == 0) return;
+		dl->AddImageQuad((ImTextureID)(intptr_t) tex,
+						 {p0.x, p0.y}, {p1.x, p0.y}, {p1.x, p1.y}, {p0.x, p1.y},
+						 {0, 0}, {0, 1}, {1, 1}, {1, 0});
+	}
+
+	// free the texture, the gl context must still be alive
+	void release() {
+		if (tex != 0)
+			glDeleteTextures(1, &tex);
+		tex = 0;
+		w = h = 0;
+	}
+};
+
+#endif //TDMA_HEATMAP_H
@@ -0,0 +1,398 @@
+#ifndef TDMA_HISTORY_H
+#define TDMA_HISTORY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Matrix.h"
+#include "Trace.h"
+
+/*
+ * The transient history of a run: the field with its border every K steps, compressed into one indexed file.
+ *
+ * every frame is xor-ed byte by byte with a reference, keyframes with the previous value of the frame and the other
+ * frames with the same value of the previous frame. the bytes are then shuffled into planes (all the first bytes of
+ * the values, then all the second bytes ...) so that the sign, exponent and high mantissa bytes, which barely change,
+ * become long runs of zeros that the packbits coder shrinks. the compression is lossless.
+ *
+ * file layout, all integers little endian:
+ *		hist_header_t
+ *		per frame: hist_frame_t followed by the packed bytes
+ *		the index: one hist_entry_t per frame
+ *		hist_trailer_t
+ *
+ * a keyframe is written every keyframe_every frames and whenever the size of the grid changes, so reading a frame
+ * decodes at most keyframe_every frames. a file whose writer died before writing the index is read by scanning it.
+ */
+
+struct hist_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t elem;
+};
+
+struct hist_frame_t {
+	uint64_t step;
+	uint64_t rows, cols;
+	uint64_t packed;
+	uint32_t key;
+	uint32_t pad;
+};
+
+struct hist_entry_t {
+	uint64_t step;
+	uint64_t offset;
+	uint64_t rows, cols;
+	uint32_t key;
+	uint32_t pad;
+};
+
+struct hist_trailer_t {
+	uint64_t count;
+	uint64_t offset;
+	char magic[8];
+};
+
+inline const char hist_magic[8] = {'T', 'D', 'M', 'A', 'H', 'I', 'S', 'T'};
+inline const char hist_index_magic[8] = {'T', 'D', 'M', 'A', 'I', 'D', 'X', 0};
+
+// xor every value of in with its reference (the value of ref, or the previous value when ref is null) and split the
+// bytes of the n values into sizeof(T) planes
+template <typename T>
+void shuffleBytes(const T* in, const T* ref, size_t n, unsigned char* out) {
+	const size_t S = sizeof(T);
+	const unsigned char* src = (const unsigned char*) in;
+	const unsigned char* rb = (const unsigned char*) ref;
+
+	for (size_t b = 0; b < S; ++b) {
+		unsigned char* plane = out + b * n;
+		if (ref) {
+			for (size_t k = 0; k < n; ++k)
+				plane[k] = src[k * S + b] ^ rb[k * S + b];
+		} else {
+			plane[0] = n ? src[b] : 0;
+			for (size_t k = 1; k < n; ++k)
+				plane[k] = src[k * S + b] ^ src[(k - 1) * S + b];
+		}
+	}
+}
+
+// the inverse of shuffleBytes
+template <typename T>
+void unshuffleBytes(const unsigned char* in, const T* ref, size_t n, T* out) {
+	const size_t S = sizeof(T);
+	unsigned char* dst = (unsigned char*) out;
+	const unsigned char* rb = (const unsigned char*) ref;
+
+	for (size_t b = 0; b < S; ++b) {
+		const unsigned char* plane = in + b * n;
+		if (ref) {
+			for (size_t k = 0; k < n; ++k)
+				dst[k * S + b] = plane[k] ^ rb[k * S + b];
+		} else if (n) {
+			dst[b] = plane[0];
+			for (size_t k = 1; k < n; ++k)
+				dst[k * S + b] = plane[k] ^ dst[(k - 1) * S + b];
+		}
+	}
+}
+
+// packbits: a control byte c < 128 is followed by c + 1 literal bytes, c >= 128 by one byte repeated c - 125 times
+inline void packBits(const unsigned char* in, size_t n, std::vector<unsigned char>& out) {
+	size_t k = 0;
+	while (k < n) {
+		size_t r = 1;
+		while (k + r < n && r < 130 && in[k + r] == in[k])
+			++r;
+		if (r >= 3) {
+			out.push_back(125 + r);
+			out.push_back(in[k]);
+			k += r;
+			continue;
+		}
+
+		// literals up to the next run of three
+		size_t l = 0;
+		while (k + l < n && l < 128) {
+			if (k + l + 2 < n && in[k + l] == in[k + l + 1] && in[k + l] == in[k + l + 2])
+				break;
+			++l;
+		}
+		out.push_back(l - 1);
+		out.insert(out.end(), in + k, in + k + l);
+		k += l;
+	}
+}
+
+// unpack exactly n bytes, false if the packed bytes do not decode to n bytes
+inline bool unpackBits(const unsigned char* in, size_t size, unsigned char* out, size_t n) {
+	size_t k = 0, o = 0;
+	while (k < size) {
+		unsigned char c = in[k++];
+		if (c < 128) {
+			size_t l = c + 1;
+			if (k + l > size || o + l > n) return false;
+			memcpy(out + o, in + k, l);
+			k += l;
+			o += l;
+		} else {
+			size_t r = c - 125;
+			if (k >= size || o + r > n) return false;
+			memset(out + o, in[k++], r);
+			o += r;
+		}
+	}
+	return o == n;
+}
+
+template <typename T>
+struct history_writer_t {
+
+	struct frame_t {
+		long step;
+		size_t rows, cols;
+		std::vector<T> data;
+	};
+
+	FILE* file = nullptr;
+	size_t keyframe_every = 16;
+	size_t capacity = 8;
+
+	std::deque<frame_t> queue;
+	std::vector<std::vector<T>> pool;
+	std::mutex mtx;
+	std::condition_variable pushed, popped;
+	std::thread worker;
+	bool running = false, closing = false;
+
+	std::vector<hist_entry_t> index;
+	uint64_t raw_bytes = 0, packed_bytes = 0;
+	size_t failed = 0;
+	double stalled = 0;
+
+	~history_writer_t() {close();}
+
+	bool open(const std::string& path, size_t keyframes, size_t depth) {
+		file = fopen(path.c_str(), "wb");
+		if (!file) {
+			fprintf(stderr, "cannot open %s for the history\n", path.c_str());
+			return false;
+		}
+
+		hist_header_t header = {{0}, 1, (uint32_t) sizeof(T)};
+		memcpy(header.magic, hist_magic, 8);
+		fwrite(&header, sizeof(header), 1, file);
+
+		keyframe_every = std::max<size_t>(keyframes, 1);
+		capacity = std::max<size_t>(depth, 1);
+		closing = false;
+		running = true;
+		worker = std::thread(&history_writer_t::run, this);
+		return true;
+	}
+
+	// copy M (with its border) into a pooled buffer and queue it, waits only while the queue is full
+	void push(const matrix_t<T>& M, long step) {
+		if (!running) return;
+		size_t rows = M.N() + 2, cols = M.M() + 2;
+
+		std::unique_lock<std::mutex> lock(mtx);
+		if (queue.size() >= capacity) {
+			auto t = std::chrono::steady_clock::now();
+			popped.wait(lock, [&] {return queue.size() < capacity;});
+			stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+		}
+
+		std::vector<T> data;
+		if (!pool.empty()) {
+			data.swap(pool.back());
+			pool.pop_back();
+		}
+		lock.unlock();
+
+		data.resize(rows * cols);
+		memcpy(data.data(), M.data(), rows * cols * sizeof(T));
+
+		lock.lock();
+		queue.push_back({step, rows, cols, std::move(data)});
+		pushed.notify_one();
+	}
+
+	// write the frames still queued, then the index
+	void close() {
+		if (!running) return;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			closing = true;
+		}
+		pushed.notify_one();
+		worker.join();
+		running = false;
+
+		hist_trailer_t trailer = {index.size(), (uint64_t) ftello(file), {0}};
+		memcpy(trailer.magic, hist_index_magic, 8);
+		fwrite(index.data(), sizeof(hist_entry_t), index.size(), file);
+		fwrite(&trailer, sizeof(trailer), 1, file);
+		fclose(file);
+		file = nullptr;
+	}
+
+	void run() {
+		TRACE_THREAD("history writer");
+		std::vector<T> prev;
+		size_t prev_rows = 0, prev_cols = 0, since_key = 0;
+		std::vector<unsigned char> planes, packed;
+
+		for (;;) {
+			std::unique_lock<std::mutex> lock(mtx);
+			pushed.wait(lock, [&] {return closing || !queue.empty();});
+			if (queue.empty())
+				return;
+			frame_t frame = std::move(queue.front());
+			queue.pop_front();
+			popped.notify_one();
+			lock.unlock();
+			TRACE_ZONE("write history frame");
+
+			size_t n = frame.rows * frame.cols;
+			bool key = since_key == 0 || frame.rows != prev_rows || frame.cols != prev_cols;
+			since_key = ((key ? 0 : since_key) + 1) % keyframe_every;
+
+			planes.resize(n * sizeof(T));
+			shuffleBytes(frame.data.data(), key ? nullptr : prev.data(), n, planes.data());
+			packed.clear();
+			packBits(planes.data(), planes.size(), packed);
+
+			hist_frame_t record = {(uint64_t) frame.step, frame.rows, frame.cols, packed.size(), key, 0};
+			hist_entry_t entry = {record.step, (uint64_t) ftello(file), frame.rows, frame.cols, key, 0};
+			bool ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+					  fwrite(packed.data(), 1, packed.size(), file) == packed.size();
+
+			// the written frame is the reference of the next one, the old reference goes back to the pool
+			prev.swap(frame.data);
+			prev_rows = frame.rows;
+			prev_cols = frame.cols;
+
+			lock.lock();
+			if (ok) {
+				index.push_back(entry);
+				raw_bytes += n * sizeof(T);
+				packed_bytes += sizeof(record) + packed.size();
+			} else {
+				++failed;
+				since_key = 0;
+			}
+			pool.push_back(std::move(frame.data));
+		}
+	}
+};
+
+// random access to the frames of a history file
+template <typename T>
+struct history_reader_t {
+
+	FILE* file = nullptr;
+	std::vector<hist_entry_t> index;
+
+	// the last decoded frame, reading forward from it avoids going back to the keyframe
+	long cur = -1;
+	std::vector<T> data;
+
+	~history_reader_t() {
+		if (file) fclose(file);
+	}
+
+	bool open(const std::string& path) {
+		file = fopen(path.c_str(), "rb");
+		hist_header_t header;
+		if (!file || fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, hist_magic, 8) != 0 ||
+			header.elem != sizeof(T))
+			return false;
+
+		// the index from the trailer, or rebuilt by walking the frames
+		hist_trailer_t trailer;
+		if (fseeko(file, -(off_t) sizeof(trailer), SEEK_END) == 0 && fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+			memcmp(trailer.magic, hist_index_magic, 8) == 0) {
+			index.resize(trailer.count);
+			fseeko(file, trailer.offset, SEEK_SET);
+			return fread(index.data(), sizeof(hist_entry_t), index.size(), file) == index.size();
+		}
+
+		fseeko(file, sizeof(header), SEEK_SET);
+		hist_frame_t record;
+		off_t offset = ftello(file);
+		while (fread(&record, sizeof(record), 1, file) == 1 && fseeko(file, record.packed, SEEK_CUR) == 0) {
+			off_t next = ftello(file);
+			fseeko(file, 0, SEEK_END);
+			if (ftello(file) < next) break;
+			fseeko(file, next, SEEK_SET);
+			index.push_back({record.step, (uint64_t) offset, record.rows, record.cols, record.key, 0});
+			offset = next;
+		}
+		return true;
+	}
+
+	size_t frames() const {return index.size();}
+
+	// the last frame written at the given step, -1 if there is none
+	long find(long step) const {
+		for (size_t k = index.size(); k-- > 0;)
+			if ((long) index[k].step == step)
+				return k;
+		return -1;
+	}
+
+	// decode a frame into M (the border included)
+	bool read(size_t frame, matrix_t<T>& M) {
+		if (frame >= index.size())
+			return false;
+
+		size_t first = frame;
+		while (!index[first].key && first > 0)
+			--first;
+		if (!index[first].key)
+			return false;
+		if (cur >= (long) first && cur <= (long) frame)
+			first = cur + 1;
+
+		std::vector<unsigned char> packed, planes;
+		for (size_t k = first; k <= frame; ++k) {
+			const hist_entry_t& e = index[k];
+			hist_frame_t record;
+			size_t n = e.rows * e.cols;
+			if (fseeko(file, e.offset, SEEK_SET) != 0 || fread(&record, sizeof(record), 1, file) != 1)
+				return false;
+
+			packed.resize(record.packed);
+			planes.resize(n * sizeof(T));
+			if (fread(packed.data(), 1, packed.size(), file) != packed.size() ||
+				!unpackBits(packed.data(), packed.size(), planes.data(), planes.size()))
+				return false;
+
+			if (e.key) {
+				data.resize(n);
+				unshuffleBytes(planes.data(), (const T*) nullptr, n, data.data());
+			} else {
+				// the reference and the result are the same buffer, every value only depends on its own reference
+				unshuffleBytes(planes.data(), data.data(), n, data.data());
+			}
+			cur = k;
+		}
+
+		M.init(index[frame].rows - 2, index[frame].cols - 2);
+		memcpy(M.data(), data.data(), data.size() * sizeof(T));
+		return true;
+	}
+};
+
+#endif //TDMA_HISTORY_H
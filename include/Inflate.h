@@ -0,0 +1,244 @@
+#ifndef TDMA_INFLATE_H
+#define TDMA_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+/*
+ * A decoder of zlib streams (rfc 1950 and 1951) for the images the solvers read, the counterpart of the stored blocks
+ * the png writer of FrameWriter.h produces: stored, fixed and dynamic huffman blocks, the codes decoded a bit at a time
+ * from canonical counts. it is meant for inputs read once at startup, not for speed. the output is bounded by the size
+ * the caller expects, a stream that would inflate past it fails at that point instead of growing the output first.
+ */
+
+struct inflate_t {
+	const unsigned char* in;
+	size_t n, pos = 0;
+	uint32_t bits = 0;
+	int count = 0;
+	bool error = false;
+	std::vector<unsigned char>& out;
+	size_t limit;
+
+	// a canonical huffman code: the number of codes of every length and the symbols ordered by code
+	struct huffman_t {
+		short count[16];
+		short symbol[288];
+	};
+
+	// limit is the size out may reach
+	inflate_t(const unsigned char* data, size_t size, std::vector<unsigned char>& dst, size_t max)
+		: in(data), n(size), out(dst), limit(max) {}
+
+	// the next need bits, least significant first
+	uint32_t bit(int need) {
+		uint32_t v = bits;
+		while (count < need) {
+			if (pos >= n) {
+				error = true;
+				return 0;
+			}
+			v |= (uint32_t) in[pos++] << count;
+			count += 8;
+		}
+		bits = v >> need;
+		count -= need;
+		return v & ((1u << need) - 1);
+	}
+
+	int decode(const huffman_t& h) {
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len < 16 && !error; ++len) {
+			code |= bit(1);
+			int c = h.count[len];
+			if (code - c < first)
+				return h.symbol[index + (code - first)];
+			index += c;
+			first = (first + c) << 1;
+			code <<= 1;
+		}
+		error = true;
+		return -1;
+	}
+
+	// the code of the lengths of n symbols, false when the lengths over-subscribe the code
+	static bool build(huffman_t& h, const short* length, int n) {
+		short offs[16];
+		for (int len = 0; len < 16; ++len)
+			h.count[len] = 0;
+		for (int s = 0; s < n; ++s)
+			h.count[length[s]]++;
+
+		int left = 1;
+		for (int len = 1; len < 16; ++len) {
+			left = (left << 1) - h.count[len];
+			if (left < 0)
+				return false;
+		}
+
+		offs[1] = 0;
+		for (int len = 1; len < 15; ++len)
+			offs[len + 1] = offs[len] + h.count[len];
+		for (int s = 0; s < n; ++s)
+			if (length[s] != 0)
+				h.symbol[offs[length[s]]++] = s;
+		return true;
+	}
+
+	bool stored() {
+		bits = 0;
+		count = 0;
+		if (pos + 4 > n)
+			return false;
+		size_t len = in[pos] | in[pos + 1] << 8;
+		if ((size_t)(in[pos + 2] | in[pos + 3] << 8) != (~len & 0xffff))
+			return false;
+		pos += 4;
+		if (pos + len > n || len > limit - out.size())
+			return false;
+		out.insert(out.end(), in + pos, in + pos + len);
+		pos += len;
+		return true;
+	}
+
+	bool codes(const huffman_t& lencode, const huffman_t& distcode) {
+		static const short lbase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83,
+										99, 115, 131, 163, 195, 227, 258};
+		static const short lext[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5,
+									   5, 0};
+		static const short dbase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+										1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		static const short dext[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+									   12, 12, 13, 13};
+
+		for (;;) {
+			int sym = decode(lencode);
+			if (error || sym < 0)
+				return false;
+			if (sym < 256) {
+				if (out.size() >= limit)
+					return false;
+				out.push_back(sym);
+				continue;
+			}
+			if (sym == 256)
+				return true;
+
+			sym -= 257;
+			if (sym >= 29)
+				return false;
+			size_t len = lbase[sym] + bit(lext[sym]);
+			sym = decode(distcode);
+			if (error || sym < 0 || sym >= 30)
+				return false;
+			size_t dist = dbase[sym] + bit(dext[sym]);
+			if (error || dist > out.size() || len > limit - out.size())
+				return false;
+			for (size_t k = 0; k < len; ++k)
+				out.push_back(out[out.size() - dist]);
+		}
+	}
+
+	bool fixed() {
+		static huffman_t lencode, distcode;
+		static bool built = false;
+		if (!built) {
+			short length[288];
+			for (int s = 0; s < 288; ++s)
+				length[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+			build(lencode, length, 288);
+			for (int s = 0; s < 30; ++s)
+				length[s] = 5;
+			build(distcode, length, 30);
+			built = true;
+		}
+		return codes(lencode, distcode);
+	}
+
+	bool dynamic() {
+		static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+		short length[320];
+		huffman_t lencode, distcode;
+
+		int nlen = bit(5) + 257, ndist = bit(5) + 1, ncode = bit(4) + 4;
+		if (error || nlen > 286 || ndist > 30)
+			return false;
+
+		for (int k = 0; k < 19; ++k)
+			length[order[k]] = k < ncode ? bit(3) : 0;
+		if (!build(lencode, length, 19))
+			return false;
+
+		// the lengths of both codes, with runs of the previous length or of zeros
+		for (int k = 0; k < nlen + ndist;) {
+			int sym = decode(lencode);
+			if (error || sym < 0)
+				return false;
+			if (sym < 16) {
+				length[k++] = sym;
+				continue;
+			}
+			short len = 0;
+			int repeat;
+			if (sym == 16) {
+				if (k == 0)
+					return false;
+				len = length[k - 1];
+				repeat = 3 + bit(2);
+			} else if (sym == 17) {
+				repeat = 3 + bit(3);
+			} else {
+				repeat = 11 + bit(7);
+			}
+			if (k + repeat > nlen + ndist)
+				return false;
+			while (repeat--)
+				length[k++] = len;
+		}
+
+		if (length[256] == 0 || !build(lencode, length, nlen) || !build(distcode, length + nlen, ndist))
+			return false;
+		return codes(lencode, distcode);
+	}
+
+	// the deflate blocks up to the last one
+	bool blocks() {
+		int last;
+		do {
+			last = bit(1);
+			int type = bit(2);
+			bool ok = type == 0 ? stored() : type == 1 ? fixed() : type == 2 ? dynamic() : false;
+			if (!ok || error)
+				return false;
+		} while (!last);
+		return true;
+	}
+};
+
+// append the data of a zlib stream to out, false when it is not a valid stream, its checksum does not match or it holds
+// more than limit bytes
+inline bool inflateZlib(const unsigned char* data, size_t size, std::vector<unsigned char>& out, size_t limit) {
+	if (size < 6 || (data[0] & 0x0f) != 8 || (data[0] << 8 | data[1]) % 31 != 0 || (data[1] & 0x20))
+		return false;
+
+	size_t start = out.size();
+	inflate_t s(data + 2, size - 2, out, out.size() + std::min(limit, SIZE_MAX - out.size()));
+	if (!s.blocks())
+		return false;
+
+	// the adler32 of the data follows the blocks, at the next byte
+	size_t p = 2 + s.pos;
+	if (p + 4 > size)
+		return false;
+	uint32_t a = 1, b = 0;
+	for (size_t k = start; k < out.size(); ++k) {
+		a = (a + out[k]) % 65521;
+		b = (b + a) % 65521;
+	}
+	uint32_t adler = (uint32_t) data[p] << 24 | data[p + 1] << 16 | data[p + 2] << 8 | data[p + 3];
+	return adler == (b << 16 | a);
+}
+
+#endif //TDMA_INFLATE_H
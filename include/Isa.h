@@ -0,0 +1,83 @@
+#ifndef TDMA_ISA_H
+#define TDMA_ISA_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+/*
+ * Runtime selection of the instruction set the hot kernels run with, so that one binary built without -march uses
+ * AVX2 or AVX-512 where the cpu has them:
+ *		ISA_DISPATCH(name, kernel)		defines name_sse2, name_avx2 and name_avx512, each a copy of the template kernel
+ *										compiled for that instruction set, nameIsa(isa, args...) that calls one of them
+ *										and name(args...) that calls the one of isaSelected()
+ *
+ * the variants are flattened: everything kernel calls is inlined into them and compiled for their instruction set too.
+ * isaSelected() is the best set the cpu supports, or the one named in TDMA_ISA (sse2, avx2 or avx512) when the cpu
+ * supports it, to compare the variants. on other architectures than x86 every variant is the plain build.
+ */
+
+enum isa_t { ISA_SSE2, ISA_AVX2, ISA_AVX512, ISA_COUNT };
+inline const char* isa_names[ISA_COUNT] = {"sse2", "avx2", "avx512"};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ISA_TARGET_SSE2	__attribute__((flatten))
+#define ISA_TARGET_AVX2	__attribute__((flatten, target("avx2,fma")))
+#define ISA_TARGET_AVX512	__attribute__((flatten, target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma")))
+#else
+#define ISA_TARGET_SSE2	__attribute__((flatten))
+#define ISA_TARGET_AVX2	__attribute__((flatten))
+#define ISA_TARGET_AVX512	__attribute__((flatten))
+#endif
+
+// whether the cpu can run the variants of an instruction set
+inline bool isaSupported(isa_t isa) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	switch (isa) {
+		case ISA_AVX512:
+			return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+				   __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+		case ISA_AVX2:
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		default:
+			return true;
+	}
+#else
+	return isa == ISA_SSE2;
+#endif
+}
+
+inline isa_t isaDetect() {
+	const char* name = getenv("TDMA_ISA");
+	if (name) {
+		for (int k = ISA_COUNT - 1; k >= 0; --k)
+			if (strcmp(name, isa_names[k]) == 0 && isaSupported((isa_t) k))
+				return (isa_t) k;
+	}
+	for (int k = ISA_COUNT - 1; k > 0; --k)
+		if (isaSupported((isa_t) k))
+			return (isa_t) k;
+	return ISA_SSE2;
+}
+
+// detected once, the first time a kernel runs
+inline isa_t isaSelected() {
+	static const isa_t isa = isaDetect();
+	return isa;
+}
+
+#define ISA_DISPATCH(name, kernel) \
+	template <typename... A> ISA_TARGET_SSE2 auto name##_sse2(A&&... a) {return kernel(std::forward<A>(a)...);} \
+	template <typename... A> ISA_TARGET_AVX2 auto name##_avx2(A&&... a) {return kernel(std::forward<A>(a)...);} \
+	template <typename... A> ISA_TARGET_AVX512 auto name##_avx512(A&&... a) {return kernel(std::forward<A>(a)...);} \
+	template <typename... A> auto name##Isa(isa_t isa, A&&... a) { \
+		switch (isa) { \
+			case ISA_AVX512: return name##_avx512(std::forward<A>(a)...); \
+			case ISA_AVX2: return name##_avx2(std::forward<A>(a)...); \
+			default: return name##_sse2(std::forward<A>(a)...); \
+		} \
+	} \
+	template <typename... A> auto name(A&&... a) {return name##Isa(isaSelected(), std::forward<A>(a)...);}
+
+#endif //TDMA_ISA_H
@@ -0,0 +1,301 @@
+#ifndef TDMA_MATERIALMAP_H
+#define TDMA_MATERIALMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Inflate.h"
+
+/*
+ * A conductivity map over the plate, read from a file that is memory mapped:
+ *		pgm		binary (P5), 8 or 16 bits
+ *		png		8 or 16 bits gray, gray + alpha, rgb or rgba without interlacing, the luma of the colors. the image data
+ *				is inflated out of the mapping
+ *		raw		float32 conductivities, Nx rows along x of Ny values along y like the rows of matrix_t. the size is
+ *				given, it is read straight from the mapping
+ *
+ * the pixels of an image go from black to white over [lo, hi], its first row is the top of the plate (y = lyn) and its
+ * columns go along x. the map spans the whole plate whatever its resolution; resample() gives every cell of a grid the
+ * mean of the map over the area of the cell, so a map finer than the grid is averaged and a coarser one keeps its sharp
+ * edges.
+ */
+
+// a read only mapping of a whole file
+struct mapped_file_t {
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+
+	mapped_file_t() = default;
+	mapped_file_t(const mapped_file_t&) = delete;
+	mapped_file_t& operator=(const mapped_file_t&) = delete;
+	~mapped_file_t() {close();}
+
+	bool open(const char* path) {
+		close();
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		data = (const unsigned char*) p;
+		size = st.st_size;
+		return true;
+	}
+
+	void close() {
+		if (data)
+			munmap((void*) data, size);
+		data = nullptr;
+		size = 0;
+	}
+};
+
+enum map_format_t { MAP_PGM, MAP_PNG, MAP_RAW };
+
+struct material_map_t {
+	mapped_file_t file;
+	map_format_t format = MAP_RAW;
+
+	// the pixels along x and y
+	size_t w = 0, h = 0;
+
+	// the samples of an image, its channels and bytes per channel, and the conductivities of black and white
+	const unsigned char* pixels = nullptr;
+	std::vector<unsigned char> decoded;
+	int channels = 1, depth = 1;
+	double maxval = 255, lo = 1e-4, hi = 1e-3;
+
+	// open a map, raw_w x raw_h are the pixels of a raw map along x and y. prints what is wrong and returns false
+	bool open(const char* path, size_t raw_w, size_t raw_h, double black, double white) {
+		lo = black;
+		hi = white;
+		if (!file.open(path)) {
+			std::cerr << "failed to map " << path << std::endl;
+			return false;
+		}
+
+		const char* error = nullptr;
+		if (file.size >= 2 && file.data[0] == 'P' && file.data[1] == '5')
+			error = openPGM();
+		else if (file.size >= 8 && memcmp(file.data, "\x89PNG\r\n\x1a\n", 8) == 0)
+			error = openPNG();
+		else if (raw_w == 0 || raw_h == 0)
+			error = "is neither pgm nor png, a raw map needs its size";
+		else if (raw_w > file.size / sizeof(float) / raw_h || file.size != raw_w * raw_h * sizeof(float))
+			error = "does not hold the float32 values of the size given";
+		else {
+			format = MAP_RAW;
+			w = raw_w;
+			h = raw_h;
+		}
+
+		if (error) {
+			std::cerr << path << " " << error << std::endl;
+			file.close();
+			return false;
+		}
+		return true;
+	}
+
+	const char* openPGM() {
+		// the header: P5, width, height, maxval separated by whitespace and comments, then one whitespace. the fields
+		// come from the file, the sizes are compared by division so that no product of them wraps
+		size_t p = 2;
+		size_t v[3];
+		for (int k = 0; k < 3; ++k) {
+			for (;;) {
+				while (p < file.size && isspace(file.data[p]))
+					++p;
+				if (p < file.size && file.data[p] == '#') {
+					while (p < file.size && file.data[p] != '\n')
+						++p;
+					continue;
+				}
+				break;
+			}
+			if (p >= file.size || !isdigit(file.data[p]))
+				return "has a broken pgm header";
+			v[k] = 0;
+			while (p < file.size && isdigit(file.data[p])) {
+				v[k] = v[k] * 10 + (file.data[p++] - '0');
+				if (v[k] > INT32_MAX)
+					return "has a broken pgm header";
+			}
+		}
+		++p;
+
+		format = MAP_PGM;
+		w = v[0];
+		h = v[1];
+		maxval = v[2];
+		depth = maxval > 255 ? 2 : 1;
+		channels = 1;
+		pixels = file.data + p;
+		if (w == 0 || h == 0 || maxval == 0 || maxval > 65535 || p > file.size || w * depth > (file.size - p) / h)
+			return "is a truncated or empty pgm";
+		return nullptr;
+	}
+
+	const char* openPNG() {
+		auto be32 = [&](size_t p) {
+			return (uint32_t) file.data[p] << 24 | file.data[p + 1] << 16 | file.data[p + 2] << 8 | file.data[p + 3];
+		};
+
+		// the header and the concatenated data of the IDAT chunks
+		std::vector<unsigned char> idat;
+		int bit_depth = 0, color = -1;
+		for (size_t p = 8; p + 12 <= file.size;) {
+			size_t len = be32(p);
+			const unsigned char* type = file.data + p + 4;
+			const unsigned char* chunk = file.data + p + 8;
+			if (p + 12 + len > file.size)
+				return "is a truncated png";
+			if (memcmp(type, "IHDR", 4) == 0 && len >= 13) {
+				w = be32(p + 8);
+				h = be32(p + 12);
+				bit_depth = chunk[8];
+				color = chunk[9];
+				if (chunk[12] != 0)
+					return "is an interlaced png";
+			} else if (memcmp(type, "IDAT", 4) == 0) {
+				idat.insert(idat.end(), chunk, chunk + len);
+			} else if (memcmp(type, "IEND", 4) == 0) {
+				break;
+			}
+			p += 12 + len;
+		}
+
+		switch (color) {
+			case 0: channels = 1; break;
+			case 2: channels = 3; break;
+			case 4: channels = 2; break;
+			case 6: channels = 4; break;
+			default: return "is a png with a palette or without a header";
+		}
+		if (bit_depth != 8 && bit_depth != 16)
+			return "is a png of less than 8 bits per sample";
+		if (w == 0 || h == 0)
+			return "is an empty png";
+
+		format = MAP_PNG;
+		depth = bit_depth / 8;
+		maxval = depth == 2 ? 65535 : 255;
+		size_t bpp = channels * depth, stride = w * bpp;
+		if (w > INT32_MAX || h > INT32_MAX || stride + 1 > SIZE_MAX / h)
+			return "is a png larger than it can be";
+		if (!inflateZlib(idat.data(), idat.size(), decoded, h * (stride + 1)) || decoded.size() != h * (stride + 1))
+			return "has image data that does not inflate to its size";
+
+		// undo the filter of every scanline in place, then drop the filter bytes
+		for (size_t y = 0; y < h; ++y) {
+			unsigned char* line = decoded.data() + y * (stride + 1);
+			unsigned char filter = line[0];
+			unsigned char* cur = line + 1;
+			const unsigned char* prev = y > 0 ? cur - (stride + 1) : nullptr;
+			for (size_t k = 0; k < stride; ++k) {
+				int a = k >= bpp ? cur[k - bpp] : 0;
+				int b = prev ? prev[k] : 0;
+				int c = prev && k >= bpp ? prev[k - bpp] : 0;
+				switch (filter) {
+					case 0: break;
+					case 1: cur[k] += a; break;
+					case 2: cur[k] += b; break;
+					case 3: cur[k] += (a + b) / 2; break;
+					case 4: {
+						int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+						cur[k] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+						break;
+					}
+					default: return "has a scanline with an unknown filter";
+				}
+			}
+		}
+		for (size_t y = 0; y < h; ++y)
+			memmove(decoded.data() + y * stride, decoded.data() + y * (stride + 1) + 1, stride);
+		decoded.resize(h * stride);
+		pixels = decoded.data();
+		return nullptr;
+	}
+
+	bool empty() const {return w == 0;}
+
+	// the conductivity of the pixel px along x and py along y, py = 0 at y = ly0
+	double at(size_t px, size_t py) const {
+		if (format == MAP_RAW)
+			return ((const float*) file.data)[px * h + py];
+
+		const unsigned char* s = pixels + ((h - 1 - py) * w + px) * channels * depth;
+		auto sample = [&](int c) {return depth == 2 ? s[2 * c] << 8 | s[2 * c + 1] : s[c];};
+		double v = channels >= 3 ? 0.299 * sample(0) + 0.587 * sample(1) + 0.114 * sample(2) : sample(0);
+		return lo + (hi - lo) * v / maxval;
+	}
+
+	// the pixels under every cell of one axis: the cells are at the coordinates c, the plate spans [l0, ln] over n
+	// pixels. a cell reaches halfway to its neighbours, the share of each pixel is the part of the cell it covers
+	static void footprints(const std::vector<double>& c, double l0, double ln, size_t n, std::vector<size_t>& start,
+						   std::vector<size_t>& pixel, std::vector<double>& weight) {
+		start.assign(1, 0);
+		pixel.clear();
+		weight.clear();
+		double scale = n / (ln - l0);
+		for (size_t k = 0; k < c.size(); ++k) {
+			double lo = k > 0 ? (c[k - 1] + c[k]) / 2 : c[k] - (c[1] - c[0]) / 2;
+			double hi = k + 1 < c.size() ? (c[k] + c[k + 1]) / 2 : c[k] + (c[k] - c[k - 1]) / 2;
+			double a = std::clamp((lo - l0) * scale, 0.0, (double) n), b = std::clamp((hi - l0) * scale, 0.0, (double) n);
+
+			// a cell outside of the plate, the border ones, takes the pixel at the edge
+			if (b <= a) {
+				pixel.push_back(std::min((size_t) a, n - 1));
+				weight.push_back(1);
+			} else {
+				for (size_t p = (size_t) a; p < n && p < b; ++p) {
+					pixel.push_back(p);
+					weight.push_back((std::min(b, p + 1.0) - std::max(a, (double) p)) / (b - a));
+				}
+			}
+			start.push_back(pixel.size());
+		}
+	}
+
+	// the mean conductivity of the cells at the coordinates xs x ys of a plate [lx0, lxn] x [ly0, lyn], out[i * ys + j]
+	void resample(const std::vector<double>& xs, const std::vector<double>& ys, double lx0, double lxn, double ly0,
+				  double lyn, std::vector<double>& out) const {
+		std::vector<size_t> xstart, xpixel, ystart, ypixel;
+		std::vector<double> xweight, yweight;
+		footprints(xs, lx0, lxn, w, xstart, xpixel, xweight);
+		footprints(ys, ly0, lyn, h, ystart, ypixel, yweight);
+
+		// along x first, only the pixels under the rows asked for are read
+		std::vector<double> rows(xs.size() * h, 0.0);
+		for (size_t i = 0; i < xs.size(); ++i)
+			for (size_t e = xstart[i]; e < xstart[i + 1]; ++e)
+				for (size_t py = 0; py < h; ++py)
+					rows[i * h + py] += xweight[e] * at(xpixel[e], py);
+
+		out.assign(xs.size() * ys.size(), 0.0);
+		for (size_t i = 0; i < xs.size(); ++i)
+			for (size_t j = 0; j < ys.size(); ++j)
+				for (size_t e = ystart[j]; e < ystart[j + 1]; ++e)
+					out[i * ys.size() + j] += yweight[e] * rows[i * h + ypixel[e]];
+	}
+};
+
+#endif //TDMA_MATERIALMAP_H
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <array>
+#include <cstring>
 #include <valarray>
 
 template <typename T>
@@ -11,6 +12,7 @@ struct matrix_t {
 private:
 	size_t _N, _M;
 	T *_data = nullptr;
+	bool _owner = true;
 
 public:
 
@@ -26,10 +28,7 @@ public:
 	~matrix_t() {clear();}
 	matrix_t& operator= (const matrix_t& other) {
 		if (this == &other) return *this;
-		if (other.N() * other.M() != N() * M()) {
-			clear();
-			init(other.N(), other.M());
-		}
+		init(other.N(), other.M());
 		std::memcpy(_data, other._data, _N * _M * sizeof(T));
 		return *this;
 	}
@@ -46,6 +45,10 @@ public:
 		T *p = _data;
 		_data = other._data;
 		other._data = p;
+
+		bool o = _owner;
+		_owner = other._owner;
+		other._owner = o;
 	}
 	void init(size_t N, size_t M) {
 		if (N == this->N() && M == this->M() && _data) return;
@@ -53,12 +56,20 @@ public:
 		_N = N + 2; _M = M + 2;
 		_data = new T[_N * _M];
 	}
+	// use memory owned by someone else (e.g. an MPI window) as the N x M matrix and its border
+	void attach(pointer data, size_t N, size_t M) {
+		this->clear();
+		_N = N + 2; _M = M + 2;
+		_data = data;
+		_owner = false;
+	}
 	pointer data() const {return _data;}
 	void clear() {
 		if (_data == nullptr) return;
-		delete[] _data;
+		if (_owner) delete[] _data;
 		_N = _M = 0;
 		_data = nullptr;
+		_owner = true;
 	}
 
 	pointer operator[] (size_t i) const {return _data + (i * _M);}
@@ -0,0 +1,165 @@
+#ifndef TDMA_PERF_H
+#define TDMA_PERF_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "imgui.h"
+
+/*
+ * Rolling timings of the phases of a frame of the plotters, drawn as an ImGui panel:
+ *		per phase		min / avg / p99 over the last HISTORY frames, in ms per frame
+ *		steps/s			solver steps over the wall time of those frames
+ *		GB/s			the bytes the solver phases move (an estimate given by the app) over the time spent in them
+ *		threads			the busy time of every OpenMP thread inside the sweeps, averaged over the frames
+ *
+ * the first solver_phases phases are the ones of the solver. timers are a steady_clock read at each end of a phase,
+ * so they can stay on all the time.
+ */
+
+struct perf_overlay_t {
+
+	static constexpr int HISTORY = 240;
+
+	struct thread_t {
+		alignas(64) double busy;
+	};
+
+	std::vector<const char*> names;
+	int solver_phases = 0;
+
+	std::vector<std::vector<float>> samples;
+	std::vector<double> cur;
+	std::vector<float> walls, steps, bytes, solver;
+	std::vector<thread_t> threads;
+	std::vector<float> load;
+	int head = 0, count = 0;
+
+	double cur_steps = 0, cur_bytes = 0;
+	double last = 0;
+	bool open = true;
+
+	static double now() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void init(const std::vector<const char*>& phases, int nsolver, int nthreads) {
+		names = phases;
+		solver_phases = nsolver;
+		samples.assign(names.size(), std::vector<float>(HISTORY, 0.0f));
+		cur.assign(names.size(), 0.0);
+		walls.assign(HISTORY, 0.0f);
+		steps.assign(HISTORY, 0.0f);
+		bytes.assign(HISTORY, 0.0f);
+		solver.assign(HISTORY, 0.0f);
+		threads.assign(std::max(nthreads, 1), {0.0});
+		load.assign(threads.size(), 0.0f);
+		head = count = 0;
+		last = now();
+	}
+
+	void add(int phase, double seconds) {cur[phase] += seconds;}
+
+	// called by every thread for its own share of a parallel loop
+	void addThread(int thread, double seconds) {threads[thread].busy += seconds;}
+
+	// one solver step that moved the given bytes
+	void step(double moved) {
+		cur_steps += 1;
+		cur_bytes += moved;
+	}
+
+	// close the frame: its phases go to the history
+	void frame() {
+		double t = now();
+		double in_solver = 0;
+		for (size_t p = 0; p < names.size(); ++p) {
+			samples[p][head] = cur[p] * 1e3;
+			if ((int) p < solver_phases)
+				in_solver += cur[p];
+			cur[p] = 0;
+		}
+		walls[head] = t - last;
+		steps[head] = cur_steps;
+		bytes[head] = cur_bytes;
+		solver[head] = in_solver;
+
+		// a moving average keeps the histogram readable at high frame rates
+		for (size_t k = 0; k < threads.size(); ++k) {
+			load[k] = 0.95f * load[k] + 0.05f * threads[k].busy * 1e3;
+			threads[k].busy = 0;
+		}
+
+		cur_steps = cur_bytes = 0;
+		last = t;
+		head = (head + 1) % HISTORY;
+		count = std::min(count + 1, HISTORY);
+	}
+
+	void draw(ImVec2 pos) {
+		if (count == 0) return;
+
+		ImGui::SetNextWindowPos(pos, ImGuiCond_FirstUseEver);
+		ImGui::SetNextWindowBgAlpha(0.8f);
+		if (!ImGui::Begin("Performance", &open, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing)) {
+			ImGui::End();
+			return;
+		}
+
+		std::vector<float> sorted(count);
+		if (ImGui::BeginTable("phases", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+			ImGui::TableSetupColumn("ms per frame");
+			ImGui::TableSetupColumn("min");
+			ImGui::TableSetupColumn("avg");
+			ImGui::TableSetupColumn("p99");
+			ImGui::TableHeadersRow();
+			for (size_t p = 0; p < names.size(); ++p) {
+				std::copy(samples[p].begin(), samples[p].begin() + count, sorted.begin());
+				std::sort(sorted.begin(), sorted.end());
+				double sum = 0;
+				for (float s : sorted)
+					sum += s;
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(names[p]);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", sorted.front());
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", sum / count);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", sorted[std::min<int>(count - 1, count * 99 / 100)]);
+			}
+			ImGui::EndTable();
+		}
+
+		double wall = 0, nsteps = 0, moved = 0, in_solver = 0;
+		for (int k = 0; k < count; ++k) {
+			wall += walls[k];
+			nsteps += steps[k];
+			moved += bytes[k];
+			in_solver += solver[k];
+		}
+		ImGui::Text("frame %.2f ms (%.0f fps)", 1e3 * wall / count, count / wall);
+		ImGui::Text("%.1f steps/s, %.2f GB/s in the solver", nsteps / wall, in_solver > 0 ? moved / in_solver * 1e-9 : 0.0);
+
+		float top = *std::max_element(load.begin(), load.end());
+		ImGui::PlotHistogram("##threads", load.data(), load.size(), 0, "busy ms per frame and thread", 0.0f,
+							 std::max(top, 1e-3f) * 1.1f, ImVec2(0, 80));
+		ImGui::End();
+	}
+};
+
+// add the time spent in the scope to a phase of the overlay
+struct perf_scope_t {
+	perf_overlay_t& perf;
+	int phase;
+	double start;
+
+	perf_scope_t(perf_overlay_t& perf, int phase) : perf(perf), phase(phase), start(perf_overlay_t::now()) {}
+	~perf_scope_t() {perf.add(phase, perf_overlay_t::now() - start);}
+};
+
+#endif //TDMA_PERF_H
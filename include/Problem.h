@@ -0,0 +1,146 @@
+#ifndef TDMA_PROBLEM_H
+#define TDMA_PROBLEM_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+/*
+ * The heat problems the 2 dimension kernels solve, as a problem_t made of three policies:
+ *		conductivity	lambda(x, y) as a double, with is_constant when it is the same everywhere: the kernels then
+ *						drop the averaging of the conductivity on the faces of the cells and hoist the coefficients.
+ *						with is_tabulated it is the conductivity of every face of one grid, read from arrays by the
+ *						indexes of the cells (see Config.h)
+ *		boundary		the values of the borders x = lx0 (left), x = lxn (right), y = ly0 (bottom), y = lyn (top)
+ *						and the initial value of the cells
+ *		source			the heat source f(x, y), with is_zero when there is none: the kernels then leave it out
+ *		grid			where the nodes of a grid are, with is_uniform when they are evenly spaced over the plate: the
+ *						kernels then divide by the square of the spacing, otherwise they read the factors of the
+ *						second differences of every row and column from the arrays of the grid. a uniform grid may be
+ *						a window of a larger one, its nodes counted from row0 and col0 of that one
+ *
+ * the traits are constexpr, so every problem is a separate instantiation of the kernels with the branches it does not
+ * need removed at compile time. the function_* policies hold std::function, for problems only known at runtime.
+ */
+
+// the same conductivity everywhere
+struct uniform_conductivity_t {
+	static constexpr bool is_constant = true;
+	static constexpr bool is_tabulated = false;
+	double value = 1e-4;
+	template <typename T>
+	double operator()(T, T) const {return value;}
+};
+
+struct function_conductivity_t {
+	static constexpr bool is_constant = false;
+	static constexpr bool is_tabulated = false;
+	std::function<double(double, double)> lambda;
+	template <typename T>
+	double operator()(T x, T y) const {return lambda(x, y);}
+};
+
+// the faces of the rows [row0, row0 + rows + 2) of a grid with the border, computed once for it. x[i * stride + j] is
+// the face between the cells (i, j) and (i + 1, j), y[i * stride + j] the one between (i, j) and (i, j + 1), i counts
+// from row0
+template <typename T>
+struct face_conductivity_t {
+	static constexpr bool is_constant = false;
+	static constexpr bool is_tabulated = true;
+	size_t rows = 0, stride = 0, row0 = 0;
+	std::vector<T> x, y;
+
+	// the face between two neighbouring cells
+	T face(int ia, int ja, int ib, int jb) const {
+		if (ja == jb) return x[std::min(ia, ib) * stride + ja];
+		return y[ia * stride + std::min(ja, jb)];
+	}
+};
+
+struct no_source_t {
+	static constexpr bool is_zero = true;
+	template <typename T>
+	double operator()(T, T) const {return 0;}
+};
+
+struct function_source_t {
+	static constexpr bool is_zero = false;
+	std::function<double(double, double)> f;
+	template <typename T>
+	double operator()(T x, T y) const {return f(x, y);}
+};
+
+struct function_boundary_t {
+	std::function<double(double)> left, right, bottom, top;
+	std::function<double(double, double)> initial;
+	template <typename T> T x0(T y) const {return left(y);}
+	template <typename T> T xn(T y) const {return right(y);}
+	template <typename T> T y0(T x) const {return bottom(x);}
+	template <typename T> T yn(T x) const {return top(x);}
+	template <typename T> T t0(T x, T y) const {return initial(x, y);}
+};
+
+// the borders as polynomials c0 + c1 s + c2 s^2 ... of the coordinate s along them
+struct polynomial_boundary_t {
+	std::vector<double> left, right, bottom, top;
+	double initial = 0;
+
+	static double eval(const std::vector<double>& c, double s) {
+		double v = 0;
+		for (size_t k = c.size(); k > 0; --k)
+			v = v * s + c[k - 1];
+		return v;
+	}
+	template <typename T> T x0(T y) const {return (T) eval(left, y);}
+	template <typename T> T xn(T y) const {return (T) eval(right, y);}
+	template <typename T> T y0(T x) const {return (T) eval(bottom, x);}
+	template <typename T> T yn(T x) const {return (T) eval(top, x);}
+	template <typename T> T t0(T, T) const {return (T) initial;}
+};
+
+// the nodes (lxn - lx0) / Nx and (lyn - ly0) / Ny apart
+struct uniform_grid_t {
+	static constexpr bool is_uniform = true;
+	static constexpr int row0 = 0, col0 = 0;
+};
+
+// a uniform grid that is a window of a larger one with the same origin and spacing (the patches of Amr.h): its node i
+// is the node row0 + i of that grid and its node j the node col0 + j, at the coordinates they have there
+struct window_grid_t {
+	static constexpr bool is_uniform = true;
+	int row0 = 0, col0 = 0;
+};
+
+// a tensor product grid with its own spacing along each axis (see Config.h), for the rows [row0, row0 + rows + 2) and
+// all the columns like face_conductivity_t. x[i] and y[j] are the coordinates of the nodes, i counting from row0. the
+// second difference at a node over the distances h- and h+ to its neighbours weighs the face before it by
+// 2 / (h- (h- + h+)) and the one after it by 2 / (h+ (h- + h+)), in xm, xp, ym and yp: both are 1 / (dx * dx) on a
+// uniform grid
+struct stretched_grid_t {
+	static constexpr bool is_uniform = false;
+	size_t rows = 0, row0 = 0;
+	std::vector<double> x, y;
+	std::vector<double> xm, xp, ym, yp;
+};
+
+template <typename Conductivity, typename Boundary, typename Source = no_source_t, typename Grid = uniform_grid_t>
+struct problem_t {
+	static constexpr bool is_constant_conductivity = Conductivity::is_constant;
+	static constexpr bool is_tabulated_conductivity = Conductivity::is_tabulated;
+	static constexpr bool has_source = !Source::is_zero;
+	static constexpr bool is_uniform_grid = Grid::is_uniform;
+
+	Conductivity conductivity;
+	Boundary boundary;
+	Source source;
+	Grid grid;
+
+	// the plate [lx0, lxn] x [ly0, lyn] and the time step
+	double lx0 = 0, lxn = 1, ly0 = 0, lyn = 0.5;
+	double dt = 0.01;
+};
+
+using runtime_problem_t = problem_t<function_conductivity_t, function_boundary_t, function_source_t>;
+
+#endif //TDMA_PROBLEM_H
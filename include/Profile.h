@@ -0,0 +1,145 @@
+#ifndef TDMA_PROFILE_H
+#define TDMA_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mpi.h"
+
+/*
+ * Per rank and per step breakdown of where the time of the MPI solver goes:
+ *		PROF_COMPUTE	the sweeps of calculate()
+ *		PROF_SEND		posting and completing sends, puts and the send side of gathers
+ *		PROF_RECV		waiting for receives, the root side of gathers and ghost row copies
+ *		PROF_WAIT		synchronization only: broadcasts of commands, window syncs, handshakes, allgathers
+ *
+ * the time of a step runs from the start of one step to the start of the next one, so the commands and the
+ * rendering that follow a step are accounted to it, and whatever is not in a phase shows up as other.
+ */
+
+enum prof_phase_t { PROF_COMPUTE, PROF_SEND, PROF_RECV, PROF_WAIT, PROF_PHASES };
+
+struct prof_step_t {
+	long step;
+	double wall;
+	double t[PROF_PHASES];
+	uint64_t sent, recv;
+};
+
+struct profiler_t {
+
+	bool enabled = false;
+	std::vector<prof_step_t> steps;
+	prof_step_t cur = {-1, 0, {0}, 0, 0};
+	double start = 0;
+
+	// close the record of the last step and open the one of the given step
+	void next(long step) {
+		if (!enabled) return;
+		double now = MPI_Wtime();
+		if (cur.step >= 0) {
+			cur.wall = now - start;
+			steps.push_back(cur);
+		}
+		cur = {step, 0, {0}, 0, 0};
+		start = now;
+	}
+
+	// close the record of the last step
+	void finish() {
+		next(-1);
+	}
+
+	void add(prof_phase_t phase, double seconds, uint64_t sent = 0, uint64_t recv = 0) {
+		cur.t[phase] += seconds;
+		cur.sent += sent;
+		cur.recv += recv;
+	}
+
+	// one line per step: step,wall,compute,send,recv,wait,bytes_sent,bytes_recv
+	void writeTrace(const std::string& path) {
+		FILE* f = fopen(path.c_str(), "w");
+		if (!f) return;
+		fprintf(f, "step,wall,compute,send,recv,wait,bytes_sent,bytes_recv\n");
+		for (const prof_step_t& s : steps)
+			fprintf(f, "%ld,%.9f,%.9f,%.9f,%.9f,%.9f,%lu,%lu\n", s.step, s.wall, s.t[PROF_COMPUTE], s.t[PROF_SEND],
+					s.t[PROF_RECV], s.t[PROF_WAIT], (unsigned long) s.sent, (unsigned long) s.recv);
+		fclose(f);
+	}
+
+	// the totals of this rank: wall, the phases, other, bytes sent and received
+	std::vector<double> totals() const {
+		std::vector<double> tot(PROF_PHASES + 4, 0.0);
+		for (const prof_step_t& s : steps) {
+			tot[0] += s.wall;
+			double other = s.wall;
+			for (int p = 0; p < PROF_PHASES; ++p) {
+				tot[1 + p] += s.t[p];
+				other -= s.t[p];
+			}
+			tot[PROF_PHASES + 1] += other;
+			tot[PROF_PHASES + 2] += s.sent;
+			tot[PROF_PHASES + 3] += s.recv;
+		}
+		return tot;
+	}
+
+	// the share of the wall time all ranks spent communicating or waiting, collective over comm
+	double commFraction(MPI_Comm comm) {
+		std::vector<double> tot = totals();
+		double local[2] = {tot[1 + PROF_SEND] + tot[1 + PROF_RECV] + tot[1 + PROF_WAIT], tot[0]};
+		double global[2];
+		MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, comm);
+		return global[1] > 0 ? global[0] / global[1] : 0.0;
+	}
+
+	// print the min / avg / max over the ranks of every phase on node 0, collective over comm
+	void summary(MPI_Comm comm) {
+		int rank, size;
+		MPI_Comm_rank(comm, &rank);
+		MPI_Comm_size(comm, &size);
+
+		std::vector<double> tot = totals();
+		size_t n = tot.size();
+		std::vector<double> lo(n), hi(n), sum(n);
+		MPI_Reduce(tot.data(), lo.data(), n, MPI_DOUBLE, MPI_MIN, 0, comm);
+		MPI_Reduce(tot.data(), hi.data(), n, MPI_DOUBLE, MPI_MAX, 0, comm);
+		MPI_Reduce(tot.data(), sum.data(), n, MPI_DOUBLE, MPI_SUM, 0, comm);
+		if (rank != 0) return;
+
+		const char* names[] = {"wall", "compute", "send", "recv", "wait", "other", "MB sent", "MB recv"};
+		double nsteps = std::max<size_t>(steps.size(), 1);
+		printf("%-10s %12s %12s %12s %12s %8s\n", "per step", "min", "avg", "max", "imbalance", "% wall");
+		for (size_t k = 0; k < n; ++k) {
+			bool bytes = k >= PROF_PHASES + 2;
+			double scale = bytes ? 1.0 / (1 << 20) / nsteps : 1e3 / nsteps;
+			double avg = sum[k] / size;
+			printf("%-10s %12.4f %12.4f %12.4f %12.2f", names[k], lo[k] * scale, avg * scale, hi[k] * scale, avg > 0 ? hi[k] / avg : 0.0);
+			if (bytes)
+				printf("\n");
+			else
+				printf(" %8.1f\n", sum[0] > 0 ? 100 * sum[k] / sum[0] : 0.0);
+		}
+		printf("(ms per step, MB per step, %zu steps, %d ranks)\n", steps.size(), size);
+	}
+};
+
+// add the time spent in the scope to a phase of a profiler
+struct prof_scope_t {
+	profiler_t& prof;
+	prof_phase_t phase;
+	uint64_t sent, recv;
+	double start;
+
+	prof_scope_t(profiler_t& prof, prof_phase_t phase, uint64_t sent = 0, uint64_t recv = 0)
+		: prof(prof), phase(phase), sent(sent), recv(recv), start(prof.enabled ? MPI_Wtime() : 0) {}
+	~prof_scope_t() {
+		if (prof.enabled)
+			prof.add(phase, MPI_Wtime() - start, sent, recv);
+	}
+};
+
+#endif //TDMA_PROFILE_H
@@ -0,0 +1,74 @@
+#ifndef TDMA_THOMAS1D_H
+#define TDMA_THOMAS1D_H
+
+#include <cmath>
+#include <chrono>
+#include <vector>
+
+#include "Isa.h"
+
+/*
+ * Thomas Algorithm:
+ *
+ * d²f/dx² = F(x)
+ * yi = alph * yi+1 + beta			and 		Ci * yi = Ai * yi+1 + Bi * yi-1 + Di
+ * => d²f/dx² = d/dx (yi+1 / h) - d/dx (yi / h)
+ * = 1/h² (yi+1  - 2yi + yi-1) = F(x)
+ *
+ * => Ai = 1  && 	Bi = 1   &&		Ci = 2		&&		Di = - h² * F(x)
+ *		alph(i) = Ai / (Ci - Bi * alph(i - 1))
+ *		beta(i) = (Bi + Di) / (Ci - Bi * alph(i - 1))
+ *
+ *		for i = 0 	B0 = 0 		&&		for i = N	AN = 0
+ */
+
+// the interval, the right hand side F(x), the value at the end and the exact solution. constants and functions rather
+// than macros, this header is included next to the 2d kernels
+constexpr double THOMAS_L0 = 0;
+constexpr double THOMAS_LN = M_PI / 2 + 4 * M_PI;
+constexpr double THOMAS_FN = -1;
+
+inline double thomasF(double x) {return std::sin(x);}
+inline double thomasYI(double x) {return -std::sin(x);}
+
+// solve the problem on N intervals into v_yi, times (if given) receives the seconds of the forward and the backward sweep.
+// thomas() runs it for the instruction set of the cpu, the recurrences are serial but the sines and the divisions are not
+inline void thomasKernel(std::vector<double>& v_yi, int N, double* times = nullptr) {
+
+	double h;
+
+	v_yi.resize(N + 1, 0.0f);
+
+	h = (THOMAS_LN - THOMAS_L0) / N;
+	std::vector<double> v_alph(N + 1);
+	std::vector<double> v_beta(N + 1);
+
+
+	v_alph[0] = 0.0f;
+	v_beta[0] = - h * h * thomasF(THOMAS_L0);
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	// forward substitution
+	for (int i = 1; i < N; ++i) {
+		v_alph[i] = 1.0f / (2 - v_alph[i - 1]);
+		v_beta[i] = (v_beta[i - 1] - h * h * thomasF(THOMAS_L0 + i * h)) / (2 - v_alph[i - 1]);
+	}
+
+	auto t1 = std::chrono::steady_clock::now();
+
+	v_yi[N - 1] = THOMAS_FN;
+	// backward substitution
+	for (int i = N - 2; i >= 0; --i) {
+		v_yi[i] = v_alph[i] * v_yi[i + 1] + v_beta[i];
+	}
+
+	if (times) {
+		times[0] = std::chrono::duration<double>(t1 - t0).count();
+		times[1] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+	}
+}
+
+ISA_DISPATCH(thomas, thomasKernel)
+
+#endif //TDMA_THOMAS1D_H
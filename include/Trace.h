@@ -0,0 +1,118 @@
+#ifndef TDMA_TRACE_H
+#define TDMA_TRACE_H
+
+/*
+ * Scoped zones recorded into per thread ring buffers and written as a Chrome trace (chrome://tracing or
+ * ui.perfetto.dev) with TRACE_DUMP. everything compiles to nothing unless TDMA_TRACE is defined (cmake -DTDMA_TRACE=ON):
+ *		TRACE_ZONE("name")				records the scope it is declared in, the name must be a string literal
+ *		TRACE_THREAD("name")			names the calling thread in the trace
+ *		TRACE_DUMP(path, pid)			writes the events of every thread, pid tells the MPI ranks apart
+ *
+ * a thread registers its buffer (under a lock) the first time it records, after that a zone is two clock reads and a
+ * store into its own ring. each ring keeps the last TDMA_TRACE_EVENTS zones of its thread. TRACE_DUMP must be called
+ * while the traced threads are idle, e.g. at the end of main.
+ */
+
+#ifdef TDMA_TRACE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef TDMA_TRACE_EVENTS
+#define TDMA_TRACE_EVENTS (1 << 18)
+#endif
+
+struct trace_event_t {
+	const char* name;
+	uint64_t begin, end;
+};
+
+struct trace_buffer_t {
+	std::vector<trace_event_t> ring = std::vector<trace_event_t>(TDMA_TRACE_EVENTS);
+	uint64_t head = 0;
+	int tid = 0;
+	std::string name;
+};
+
+struct trace_registry_t {
+	std::mutex mtx;
+	std::vector<std::unique_ptr<trace_buffer_t>> buffers;
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+	static trace_registry_t& get() {
+		static trace_registry_t registry;
+		return registry;
+	}
+
+	trace_buffer_t* add() {
+		std::lock_guard<std::mutex> lock(mtx);
+		buffers.emplace_back(new trace_buffer_t);
+		buffers.back()->tid = buffers.size() - 1;
+		return buffers.back().get();
+	}
+
+	// ns since the start of the process
+	uint64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	bool dump(const char* path, int pid) {
+		FILE* f = fopen(path, "w");
+		if (!f) return false;
+
+		std::lock_guard<std::mutex> lock(mtx);
+		fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}", pid, pid);
+		for (auto& b : buffers) {
+			if (!b->name.empty())
+				fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+						pid, b->tid, b->name.c_str());
+			uint64_t first = b->head > b->ring.size() ? b->head - b->ring.size() : 0;
+			for (uint64_t k = first; k < b->head; ++k) {
+				const trace_event_t& e = b->ring[k % b->ring.size()];
+				fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+						e.name, pid, b->tid, e.begin * 1e-3, (e.end - e.begin) * 1e-3);
+			}
+		}
+		fprintf(f, "\n]}\n");
+		return fclose(f) == 0;
+	}
+};
+
+inline trace_buffer_t& traceBuffer() {
+	thread_local trace_buffer_t* buffer = trace_registry_t::get().add();
+	return *buffer;
+}
+
+struct trace_zone_t {
+	const char* name;
+	uint64_t begin;
+
+	explicit trace_zone_t(const char* name) : name(name), begin(trace_registry_t::get().now()) {}
+	~trace_zone_t() {
+		trace_buffer_t& b = traceBuffer();
+		b.ring[b.head % b.ring.size()] = {name, begin, trace_registry_t::get().now()};
+		++b.head;
+	}
+};
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_ZONE(name) trace_zone_t TRACE_CAT(trace_zone_, __LINE__)(name)
+#define TRACE_THREAD(label) (traceBuffer().name = (label))
+#define TRACE_DUMP(path, pid) trace_registry_t::get().dump(path, pid)
+
+#else
+
+#define TRACE_ZONE(name) ((void) 0)
+#define TRACE_THREAD(name) ((void) 0)
+#define TRACE_DUMP(path, pid) ((void) 0)
+
+#endif
+
+#endif //TDMA_TRACE_H
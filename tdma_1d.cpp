@@ -7,68 +7,38 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 
+#include "include/Thomas1d.h"
+#include "include/Perf.h"
+
 
 #define MAXDIFF 0
 #define DEBUG	0
 #define PLOT	1
 
-/*
- * Thomas Algorithm:
- *
- * d²f/dx² = F(x)
- * yi = alph * yi+1 + beta			and 		Ci * yi = Ai * yi+1 + Bi * yi-1 + Di
- * => d²f/dx² = d/dx (yi+1 / h) - d/dx (yi / h)
- * = 1/h² (yi+1  - 2yi + yi-1) = F(x)
- *
- * => Ai = 1  && 	Bi = 1   &&		Ci = 2		&&		Di = - h² * F(x)
- *		alph(i) = Ai / (Ci - Bi * alph(i - 1))
- *		beta(i) = (Bi + Di) / (Ci - Bi * alph(i - 1))
- *
- *		for i = 0 	B0 = 0 		&&		for i = N	AN = 0
- */
-
-#define L0	0
-#define LN	(M_PI/2 +  4 * M_PI)
-#define F(x) (std::sin(x))
-#define FN	-1
-
-#define YI(x) (-std::sin(x))
-
+// the phases of a frame in the performance panel, the solver ones first
+enum phase_t { PHASE_FORWARD, PHASE_BACKWARD, PHASE_DRAW, PHASE_RENDER };
+perf_overlay_t g_perf;
 
 void calculate(std::vector<double>& v_yi, int N) {
 
-	double h;
-
-	v_yi.resize(N + 1, 0.0f);
-
-	h = (double)(LN - L0) / N;
-	std::vector<double> v_alph(N + 1);
-	std::vector<double> v_beta(N + 1);
-
+	double t[2];
+	thomas(v_yi, N, t);
 
-	v_alph[0] = 0.0f;
-	v_beta[0] = - h * h * F(L0);
-
-	// forward substitution
-	for (int i = 1; i < N; ++i) {
-		v_alph[i] = 1.0f / (2 - v_alph[i - 1]);
-		v_beta[i] = (v_beta[i - 1] - h * h * F(L0 + i * h)) / (2 - v_alph[i - 1]);
-	}
-
-	v_yi[N - 1] = FN;
-	// backward substitution
-	for (int i = N - 2; i >= 0; --i) {
-		v_yi[i] = v_alph[i] * v_yi[i + 1] + v_beta[i];
-	}
+	// the forward sweep writes alph and beta, the backward one reads them back and writes yi
+	g_perf.add(PHASE_FORWARD, t[0]);
+	g_perf.add(PHASE_BACKWARD, t[1]);
+	g_perf.addThread(0, t[0] + t[1]);
+	g_perf.step(5.0 * (N + 1) * sizeof(double));
 
 #if MAXDIFF
+	double h = (THOMAS_LN - THOMAS_L0) / N;
 	double maxdif = -1.0;
 	for (int i = 0; i < N; ++i) {
-		if (std::fabs(v_yi[i] - YI(L0 + i * h)) > maxdif)
-			maxdif = std::fabs(v_yi[i] + F(L0 + i * h));
+		if (std::fabs(v_yi[i] - thomasYI(THOMAS_L0 + i * h)) > maxdif)
+			maxdif = std::fabs(v_yi[i] + thomasF(THOMAS_L0 + i * h));
 #if DEBUG
-		std::cout << "x= " << L0 + i * h << ",  yi = " << v_yi[i] << ",  -sin(x) = " <<
-		YI(L0 + i * h) << ",  diff= " << v_yi[i] - YI(L0 + i * h) << std::endl;
+		std::cout << "x= " << THOMAS_L0 + i * h << ",  yi = " << v_yi[i] << ",  -sin(x) = " <<
+		thomasYI(THOMAS_L0 + i * h) << ",  diff= " << v_yi[i] - thomasYI(THOMAS_L0 + i * h) << std::endl;
 #endif
 	}
 	std::cout << "maxDifference = " << maxdif << std::endl;
@@ -152,6 +122,7 @@ int plot(std::vector<double> v_yi, int* N) {
 	ImGuiWindowFlags window_flag;
 	ImVec4 clear_color;
 	static int display_count = *N;
+	static bool every_frame = false;
 	double h;
 
 
@@ -189,6 +160,7 @@ int plot(std::vector<double> v_yi, int* N) {
 		}
 
 		// Start the Dear ImGui frame
+		double t = perf_overlay_t::now();
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplSDL2_NewFrame();
 		ImGui::NewFrame();
@@ -199,26 +171,38 @@ int plot(std::vector<double> v_yi, int* N) {
 		// Main body of the Demo window starts here.
 		ImGui::Begin("Plotter", NULL, window_flag);
 		ImGui::SliderInt("Sample count", &display_count, 10, 1000);
+		ImGui::Checkbox("Solve every frame", &every_frame);
+		ImGui::SameLine();
+		ImGui::Checkbox("Performance", &g_perf.open);
+		g_perf.add(PHASE_DRAW, perf_overlay_t::now() - t);
 
-		if (display_count != *N) {
+		if (display_count != *N || every_frame) {
 			*N = display_count;
-			h = (double)(LN - L0) / *N;
+			h = (THOMAS_LN - THOMAS_L0) / *N;
 			v_yi.clear();
 			calculate(v_yi, *N);
 		}
 
+		t = perf_overlay_t::now();
 //		float (*func)(void*, int) = Funcs::Sin;
 		ImGui::PlotHistogram("", Funcs::Get, v_yi.begin().base(), *N, h, NULL, -1.5f, 1.5f, ImVec2(io.DisplaySize.x, 600));
 		ImGui::PushItemWidth(-1);
 		ImGui::End();
+		if (g_perf.open)
+			g_perf.draw({io.DisplaySize.x - 380, 10});
 
-		// Rendering
 		ImGui::Render();
+		g_perf.add(PHASE_DRAW, perf_overlay_t::now() - t);
+
+		// Rendering, the swap waits for vsync
+		t = perf_overlay_t::now();
 		glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
 		glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
 		glClear(GL_COLOR_BUFFER_BIT);
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 		SDL_GL_SwapWindow(window);
+		g_perf.add(PHASE_RENDER, perf_overlay_t::now() - t);
+		g_perf.frame();
 	}
 
 	// Cleanup
@@ -235,6 +219,8 @@ int main(int argc, char** argv) {
 	std::vector<double> v_yi;
 	int N = 100;
 
+	g_perf.init({"forward sweep", "backward sweep", "draw lists", "render + swap"}, 2, 1);
+
 	if (argc > 1) {
 		N = std::strtol(argv[1], nullptr, 10);
 	}
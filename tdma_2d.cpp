@@ -3,6 +3,8 @@
 #include "cmath"
 #include "iomanip"
 #include "cstring"
+#include "algorithm"
+#include "type_traits"
 
 #include "imgui.h"
 #include "include/imgui_impl_sdl2.h"
@@ -11,46 +13,71 @@
 #include <SDL2/SDL_opengl.h>
 
 #include "include/Matrix.h"
+#include "include/Heat2d.h"
+#include "include/Config.h"
+#include "include/Ensemble.h"
+#include "include/Amr.h"
+#include "include/Heatmap.h"
+#include "include/Downsample.h"
+#include "include/FrameWriter.h"
+#include "include/History.h"
+#include "include/Perf.h"
+#include "include/Counters.h"
+#include "include/Trace.h"
 #include "omp.h"
 
 // define the initial width and height of the matrix, this can be changed at runtime
 #define NX  200
 #define NY	100
 
-// define the intervals for x and y
-#define LX0 0
-#define LXn 1.0f
-#define LY0 0
-#define LYn 0.5f
-
-// define the border values
-#define F(x) (0)
-#define LMD(x,y) ( (x >= 0.25f && x <= 0.65f && y >= 0.1f && y <= 0.25f) ? 1e-3 : 1e-4 )
-#define X0(y) (600)
-#define XN(y) (1200)
-#define Y0(x) (600 * (1 + x))
-#define YN(x) (600 * (1 + x * x))
-
-// define the initial values for the matrix
-#define FT0(x, y) 	(300)
-
-// define the coordinates x and y from the indexes i and j
-#define X(i, dx)	data_t(LX0 + i * dx)
-#define Y(j, dy)	data_t(LY0 + j * dy)
-
-// define the increment of time delta_t
-#define DT 0.01f;
-
 // define the data type for the matrix
 using data_t = float;
 
-// define the interval for the s component in HSV colors
+// define the interval of values the colormap spans
 const float max = 1000, min = 0;
 
 // using two matrices as buffers
 using Mtrix = matrix_t<data_t>;
 Mtrix GM2;
 
+// the plate of Heat2d.h, or with --uniform the same plate with one conductivity everywhere, which runs kernels
+// specialized for it
+plate_problem_t g_plate;
+uniform_problem_t g_uniform(1e-4);
+bool g_use_uniform = false;
+
+// with --config the plate of a config file, lowered to face arrays for the size of the grid, and to the spacing of
+// the stretched grid when the file clusters the nodes
+plate_config_t g_config;
+config_problem_t<data_t> g_table;
+config_problem_t<data_t, stretched_grid_t> g_stretched;
+bool g_use_config = false;
+
+// with --ensemble the members of a file over that plate, stepped together in the lanes of the sweeps (see Ensemble.h).
+// g_member is the one drawn and exported
+std::vector<plate_config_t> g_members;
+ensemble_t<data_t> g_ensemble, g_ensemble2;
+int g_member = 0;
+
+// with --amr the plate of Heat2d.h with patches refined that many times where its field is steep or its conductivity
+// jumps (see Amr.h), M is a copy of the coarse level
+amr_t<plate_problem_t, data_t> g_amr;
+bool g_use_amr = false;
+
+// the field goes to the frame writer every g_export_every steps, 0 exports nothing
+frame_writer_t<data_t> g_export;
+int g_export_every = 0;
+
+// the field is appended to the compressed history every g_history_every steps, 0 keeps no history
+history_writer_t<data_t> g_history;
+int g_history_every = 0;
+
+// the phases of a frame in the performance panel, the solver ones first
+enum phase_t { PHASE_COPY, PHASE_ROWS, PHASE_COLS, PHASE_COLORIZE, PHASE_DRAW, PHASE_RENDER };
+perf_overlay_t g_perf;
+counters_t g_counters;
+long g_step = 0;
+
 // helper functions for visualization
 double mapValInterval(float iMin, float iMax, float jMin, float jMax, float val) {
 	if (iMax <= iMin || jMax <= jMin)
@@ -58,24 +85,6 @@ double mapValInterval(float iMin, float iMax, float jMin, float jMax, float val)
 	return (val - iMin) * (jMax - jMin) / (iMax - iMin) + jMin;
 }
 
-ImU32 mapValueToColor(float value) {
-
-	float normalizedValue;
-	if (max != min)
-		normalizedValue = (value - min) / (max - min);
-	else
-		normalizedValue = 0.0f;
-
-	float r,g,b,h,s,v;
-
-	h = 0.1;
-	s = normalizedValue;
-	v = 0.5f;
-
-	ImGui::ColorConvertHSVtoRGB(h,s,v, r,g,b);
-	return ImGui::ColorConvertFloat4ToU32({r,g,b,1.0f});
-}
-
 // print the values to the terminal for debugging
 void printMatrix(Mtrix& M) {
 
@@ -91,132 +100,126 @@ void printMatrix(Mtrix& M) {
 
 }
 
-// create a matrix and fill it with initial and border values
-void initMatrix(Mtrix& M, size_t Nx, size_t Ny) {
-
-	M.init(Nx, Ny);
-
-	data_t dx = (LXn - LX0) / (data_t)Nx;
-	data_t dy = (LYn - LY0) / (data_t)Ny;
-	(void) dy; (void) dx;
+// calculate the values of each row then each column, of the grid M or of the members of an ensemble, through M2
+template <typename P, typename F>
+void calculate(const P& problem, F& M, F& M2) {
+	TRACE_ZONE("calculate");
+	constexpr bool ensemble = !std::is_same_v<F, Mtrix>;
 
-
-	// fill in initial values for x = 0 and x = n
-	for (size_t i = 0; i < Ny + 2; ++i) {
-		M[0][i] = X0(Y(i, dy));
-		M[Nx + 1][i] = XN(Y(i, dy));
+	{
+		perf_scope_t p(g_perf, PHASE_COPY);
+		g_counters.begin(0);
+		M2 = M;
+		g_counters.end(0, PHASE_COPY);
 	}
 
-	// fill in initial values for y = 0 and y = m
-	for (uint i = 1; i < M.N() + 1; ++i) {
-		M[i][0] = Y0(X(i, dx));
-		M[i][Ny + 1] = YN(X(i, dx));
+	// every thread reports its own time and counters in the loop, before the barrier at the end of the parallel region
+	{
+		perf_scope_t p(g_perf, PHASE_ROWS);
+#pragma omp parallel
+		{
+			int tid = omp_get_thread_num();
+			double t = perf_overlay_t::now();
+			g_counters.begin(tid);
+			if constexpr (ensemble)
+				sweepRowsLanes(problem, M, M2);
+			else
+				sweepRows(problem, M, M2);
+			g_counters.end(tid, PHASE_ROWS);
+			g_perf.addThread(tid, perf_overlay_t::now() - t);
+		}
 	}
 
-	// fill in matrix with init values
-	for (size_t i = 1; i < Nx + 1; ++i) {
-		for (size_t j = 1; j < Ny + 1; ++j) {
-			M[i][j] = FT0(X(i, dx), Y(j, dy));
+	{
+		perf_scope_t p(g_perf, PHASE_COLS);
+#pragma omp parallel
+		{
+			int tid = omp_get_thread_num();
+			double t = perf_overlay_t::now();
+			g_counters.begin(tid);
+			if constexpr (ensemble)
+				sweepColsLanes(problem, M2, M);
+			else
+				sweepCols(problem, M2, M);
+			g_counters.end(tid, PHASE_COLS);
+			g_perf.addThread(tid, perf_overlay_t::now() - t);
 		}
 	}
 
-	GM2 = M;
-}
-
-// calculate the values of a given row in the matrix
-void calculateFixRow(Mtrix& M, int row, Mtrix& M2) {
-
-	data_t dt = DT;
-
-	std::vector<data_t> v_alph(M.M() + 2);
-	std::vector<data_t> v_beta(M.M() + 2);
-
-	data_t dx = (LXn - LX0) / M.N();
-	data_t dy = (LYn - LY0) / M.M();
-
-	auto lpi2 = [&](int j) {return (data_t)(LMD(X(row + 1, dx), Y(j, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-	auto lmi2 = [&](int j) {return (data_t)(LMD(X(row - 1, dx), Y(j, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-	auto lpj2 = [&](int j) {return (data_t)(LMD(X(row , dx), Y(j + 1, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-	auto lmj2 = [&](int j) {return (data_t)(LMD(X(row, dx), Y(j - 1, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-
-	auto Ai =  [&](int j) {return (data_t)(- lmj2(j) / (2 * dy * dy));};
-	auto Bi =  [&](int j) {return (data_t)(- lpj2(j) / (2 * dy * dy));};
-	auto Ci =  [&](int j) {return (data_t)((1 / dt - Ai(j) - Bi(j)));};
-	auto Di =  [&](int j) {
-		double d1 = lpi2(j) * (M[row + 1][j] - M[row][j]);
-		double d2 = lmi2(j) * (M[row][j] - M[row][j - 1]);
-		double d3 = M[row][j] / dt;
-		return (data_t)(d3 + (d1 - d2) / (dx * dx)); };
-
-
-	v_alph[0] = 0.0f;
-	v_beta[0] = M[row][0];
-
-	// forward substitution
-	for (size_t i = 1; i < M.M() + 2; ++i) {
-		v_alph[i] = - Bi(i) / (Ci(i) + Ai(i) * v_alph[i - 1]);
-		v_beta[i] = (- Ai(i) * v_beta[i - 1] + Di(i)) / (Ci(i) + Ai(i) * v_alph[i - 1]);
+	// an ensemble solves the cells of all its members, and the lanes past them
+	double cells = (double) M.N() * M.M(), values = (double) (M.N() + 2) * (M.M() + 2);
+	if constexpr (ensemble) {
+		cells *= M.K;
+		values *= M.blocks * M.lanes;
 	}
+	g_counters.addCells(PHASE_COPY, cells);
+	g_counters.addCells(PHASE_ROWS, cells);
+	g_counters.addCells(PHASE_COLS, cells);
+	g_counters.step();
 
-	// backward substitution
-	for (size_t i = M.M(); i > 0; --i) {
-		M2[row][i] = v_alph[i] * M[row][i + 1] + v_beta[i];
-	}
+	// the copy reads and writes the grid, each sweep reads two lines of the grid and writes one per line it solves
+	g_perf.step(8.0 * values * sizeof(data_t));
 }
 
-// calculate the values of a given column in the matrix
-void calculateFixCol(Mtrix& M, int col, Mtrix& M2) {
-
-	data_t dt = DT;
-
-	std::vector<data_t> v_alph(M.N() + 2);
-	std::vector<data_t> v_beta(M.N() + 2);
-
-	data_t dx = (LXn - LX0) / M.N();
-	data_t dy = (LYn - LY0) / M.M();
-
-	auto lpi2 = [&](int i) {return (data_t)(LMD(X(i + 1, dx), Y(col, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-	auto lmi2 = [&](int i) {return (data_t)(LMD(X(i - 1, dx), Y(col, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-	auto lpj2 = [&](int i) {return (data_t)(LMD(X(i, dx), Y(col + 1, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-	auto lmj2 = [&](int i) {return (data_t)(LMD(X(i, dx), Y(col - 1, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-
-	auto Ai =  [&](int i) {return (data_t)(-lmi2(i) / (2 * dx * dx));};
-	auto Bi =  [&](int i) {return (data_t)(-lpi2(i) / (2 * dx * dx));};
-	auto Ci =  [&](int i) {return (data_t)((1 / dt) - Ai(i) - Bi(i));};
-	auto Di =  [&](int i) {
-		double d1 = lpj2(i) * (M[i][col + 1] - M[i][col]);
-		double d2 = lmj2(i) * (M[i][col] - M[i][col - 1]);
-		double d3 = M[i][col] / dt;
-		return (data_t)(d3 + (d1 - d2) / (dy * dy)); };
-
-
-	v_alph[0] = 0.0f;
-	v_beta[0] = M[1][col];
-
-	// forward substitution
-	for (size_t i = 1; i < M.N() + 2; ++i) {
-		v_alph[i] = -Bi(i) / (Ci(i) + Ai(i) * v_alph[i - 1]);
-		v_beta[i] = (Di(i) - Ai(i) * v_beta[i - 1]) / (Ci(i) + Ai(i) * v_alph[i - 1]);
+// every member of the ensemble starts from its own borders and initial values, on the grid of the problem
+template <typename P>
+void resetMembers(const P& problem, Mtrix& M, size_t Nx, size_t Ny) {
+	P member;
+	member.grid = problem.grid;
+	g_ensemble.init(g_members.size(), Nx, Ny);
+	for (size_t k = 0; k < g_members.size(); ++k) {
+		g_members[k].lowerBorders(member);
+		initMatrix(member, M, Nx, Ny);
+		g_ensemble.set(k, M, member.dt);
 	}
+	g_ensemble.get(g_member, M);
+}
 
-	// backward substitution
-	for (size_t i = M.N(); i > 0; --i) {
-		M2[i][col] = v_alph[i] * M[i + 1][col] + v_beta[i];
+// fill M with the initial values of the problem in use, a config is lowered for the grid first
+void reset(Mtrix& M, size_t Nx, size_t Ny) {
+	if (g_use_config && g_config.stretched()) {
+		g_config.lower(g_stretched, Nx, Ny);
+		initMatrix(g_stretched, M, Nx, Ny);
+		if (!g_members.empty())
+			resetMembers(g_stretched, M, Nx, Ny);
+	} else if (g_use_config) {
+		g_config.lower(g_table, Nx, Ny);
+		initMatrix(g_table, M, Nx, Ny);
+		if (!g_members.empty())
+			resetMembers(g_table, M, Nx, Ny);
+	} else if (g_use_amr) {
+		g_amr.init(g_plate, Nx, Ny);
+		M = g_amr.M;
+	} else {
+		initMatrix(g_plate, M, Nx, Ny);
 	}
 }
 
-// calculate the values of each row then each column
-void calculate(Mtrix& M) {
-
-	GM2 = M;
-
-#pragma omp parallel for
-	for (size_t i = 1; i < M.N() + 1; ++i)
-		calculateFixRow(M, i, GM2);
-
-#pragma omp parallel for
-	for (size_t j = 1; j < M.M() + 1; ++j)
-		calculateFixCol(GM2, j, M);
+// one time step, followed by a frame when one is due
+void step(Mtrix& M) {
+	if (!g_members.empty()) {
+		if (g_config.stretched())
+			calculate(g_stretched, g_ensemble, g_ensemble2);
+		else
+			calculate(g_table, g_ensemble, g_ensemble2);
+		g_ensemble.get(g_member, M);
+	} else if (g_use_config && g_config.stretched()) {
+		calculate(g_stretched, M, GM2);
+	} else if (g_use_config) {
+		calculate(g_table, M, GM2);
+	} else if (g_use_amr) {
+		g_amr.step();
+		M = g_amr.M;
+	} else if (g_use_uniform) {
+		calculate(g_uniform, M, GM2);
+	} else {
+		calculate(g_plate, M, GM2);
+	}
+	++g_step;
+	if (g_export_every > 0 && g_step % g_export_every == 0)
+		g_export.push(M, g_step);
+	if (g_history_every > 0 && g_step % g_history_every == 0)
+		g_history.push(M, g_step);
 }
 
 // initialize imgui with SDL
@@ -292,6 +295,9 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 	static int nx_count = *Nx;
 	static int ny_count = *Ny;
 	static int ti;
+	static int view_op = REDUCE_MEAN;
+
+	const char* view_ops[] = {"mean", "min", "max"};
 
 	float tj = 0.0f;
 
@@ -311,6 +317,12 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 	ImGuiIO& io = ImGui::GetIO();
 	clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+	heatmap_t heatmap;
+	colormap_t cmap;
+	int cmap_kind = COLORMAP_HSV;
+	cmap.build(COLORMAP_HSV, min, max);
+	Mtrix V;
+	std::vector<data_t> part;
 
 	// Main loop
 	bool done = false;
@@ -319,6 +331,8 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 	while (!done)
 	{
+		TRACE_ZONE("frame");
+
 		// poll sdl events
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
@@ -331,6 +345,7 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 		}
 
 		// Start the Dear ImGui frame
+		double t = perf_overlay_t::now();
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplSDL2_NewFrame();
 		ImGui::NewFrame();
@@ -339,60 +354,258 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 		// start imgui frame and add some settings to the window
 		ImGui::Begin("Plotter", NULL, window_flag);
-		ImGui::SliderInt("Nx count", &nx_count, 3, 250);
-		ImGui::SliderInt("Ny count", &ny_count, 3, 250);
+		ImGui::SliderInt("Nx count", &nx_count, 3, 1000);
+		ImGui::SliderInt("Ny count", &ny_count, 3, 1000);
 		ImGui::SliderInt("T", &ti, 0, 0);
+		if (!g_members.empty() && ImGui::SliderInt("Member", &g_member, 0, g_members.size() - 1))
+			g_ensemble.get(g_member, M);
+		ImGui::Combo("Block", &view_op, view_ops, 3);
+		if (ImGui::Combo("Colormap", &cmap_kind, colormap_names, COLORMAP_COUNT))
+			cmap.build(colormap_kind_t(cmap_kind), min, max);
+		ImGui::Checkbox("Performance", &g_perf.open);
 
 		// reinitialize the matrix if the dimensions were changed
 		if (nx_count != *Nx || ny_count != *Ny) {
 			*Nx = nx_count;
 			*Ny = ny_count;
-			initMatrix(M, *Nx, *Ny);
+			reset(M, *Nx, *Ny);
 			ti = 0;
 			tj = 0.0f;
 		}
 
+		g_perf.add(PHASE_DRAW, perf_overlay_t::now() - t);
+
 		// calculate a new iteration after dt
-		tj += DT;
+		tj += !g_members.empty() ? g_members[g_member].dt : g_use_config ? g_table.dt : DT;
 		ti = int(std::floor(tj));
-		calculate(M);
-
-		// draw the matrix to the surface
-		ImDrawList* dl = ImGui::GetWindowDrawList();
-		float xi, yi;
-		for (size_t i = 0; i < M.N() + 2; ++i) {
-			xi = 20.0f + (io.DisplaySize.x - 20) / float(M.N() + 2) * i;
-			for (size_t j = 0; j < M.M() + 2; ++j) {
-				yi = 90.0f + (io.DisplaySize.y - 90) / float(M.M() + 2) * j;
-				dl->AddRectFilled({xi,yi}, {xi + (io.DisplaySize.x - 20) / float(M.N() + 2), yi + (io.DisplaySize.y - 90) / float(M.M() + 2)}, mapValueToColor(M[i][j]));
-			}
+		step(M);
+
+		// draw the matrix to the surface as a single texture, reduced to blocks of cells when it has more cells than
+		// the plot area has pixels. the area of a window smaller than the margins is 0, not a negative float that would
+		// wrap when converted to size_t
+		t = perf_overlay_t::now();
+		size_t view_w = std::max(io.DisplaySize.x - 20, 0.0f), view_h = std::max(io.DisplaySize.y - 90, 0.0f);
+		{
+			TRACE_ZONE("colorize");
+			if (downsample(M, view_w, view_h, reduce_t(view_op), V, part))
+				heatmap.update(V, cmap);
+			else
+				heatmap.update(M, cmap);
+		}
+		g_perf.add(PHASE_COLORIZE, perf_overlay_t::now() - t);
+
+		t = perf_overlay_t::now();
+		heatmap.draw(ImGui::GetWindowDrawList(), {20.0f, 90.0f}, {io.DisplaySize.x, io.DisplaySize.y});
+
+		// the outlines of the refined patches, the rows of the grid run along x like in the heatmap
+		if (g_use_amr) {
+			float cw = (io.DisplaySize.x - 20) / (M.N() + 2), ch = (io.DisplaySize.y - 90) / (M.M() + 2);
+			for (auto& p : g_amr.patches)
+				ImGui::GetWindowDrawList()->AddRect({20 + p.box.i0 * cw, 90 + p.box.j0 * ch},
+													{20 + p.box.i1 * cw, 90 + p.box.j1 * ch}, IM_COL32(255, 255, 255, 160));
 		}
 
 		// end the recording of the frame
 		ImGui::PushItemWidth(-1);
 		ImGui::End();
+		if (g_perf.open)
+			g_perf.draw({io.DisplaySize.x - 380, 10});
 
-		// Rendering
 		ImGui::Render();
+		g_perf.add(PHASE_DRAW, perf_overlay_t::now() - t);
+
+		// Rendering, the swap waits for vsync
+		t = perf_overlay_t::now();
+		TRACE_ZONE("render + swap");
 		glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
 		glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
 		glClear(GL_COLOR_BUFFER_BIT);
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 		SDL_GL_SwapWindow(window);
+		g_perf.add(PHASE_RENDER, perf_overlay_t::now() - t);
+		g_perf.frame();
 	}
 
 	// Cleanup
+	heatmap.release();
 	freeImGui(&window, &gl_context);
 	return 0;
 }
 
 // Main program
-int main() {
-	int Nx = NX, Ny = NY;
+int main(int argc, char** argv) {
+	int Nx = 0, Ny = 0;
+	TRACE_THREAD("main");
+	const char* config = nullptr;
+	const char* ensemble = nullptr;
+	int headless_steps = 0, export_every = 10, export_queue = 8;
+	int history_every = 10, history_keyframe = 16, history_queue = 8;
+	const char* history = nullptr;
+	frame_format_t export_format = FRAME_FORMATS;
+	colormap_kind_t export_cmap = COLORMAP_HSV;
+	const char* export_out = nullptr;
+	bool counters = false;
+	double peak_gbs = 0, peak_gflops = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--nx") == 0 && i + 1 < argc)
+			Nx = std::max(3L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--ny") == 0 && i + 1 < argc)
+			Ny = std::max(3L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+			headless_steps = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--export-every") == 0 && i + 1 < argc)
+			export_every = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--export-queue") == 0 && i + 1 < argc)
+			export_queue = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--export-out") == 0 && i + 1 < argc)
+			export_out = argv[++i];
+		else if (std::strcmp(argv[i], "--history") == 0 && i + 1 < argc)
+			history = argv[++i];
+		else if (std::strcmp(argv[i], "--history-every") == 0 && i + 1 < argc)
+			history_every = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--history-keyframe") == 0 && i + 1 < argc)
+			history_keyframe = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--history-queue") == 0 && i + 1 < argc)
+			history_queue = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+			config = argv[++i];
+		else if (std::strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc)
+			ensemble = argv[++i];
+		else if (std::strcmp(argv[i], "--member") == 0 && i + 1 < argc)
+			g_member = std::max(0L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--amr") == 0 && i + 1 < argc) {
+			g_amr.ratio = std::max(2L, std::strtol(argv[++i], nullptr, 10));
+			g_use_amr = true;
+		} else if (std::strcmp(argv[i], "--amr-gradient") == 0 && i + 1 < argc)
+			g_amr.gradient = std::strtod(argv[++i], nullptr);
+		else if (std::strcmp(argv[i], "--amr-regrid") == 0 && i + 1 < argc)
+			g_amr.regrid = std::max(0L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--uniform") == 0 && i + 1 < argc) {
+			g_uniform.conductivity.value = std::strtod(argv[++i], nullptr);
+			g_use_uniform = true;
+		} else if (std::strcmp(argv[i], "--counters") == 0)
+			counters = true;
+		else if (std::strcmp(argv[i], "--peak-gbs") == 0 && i + 1 < argc)
+			peak_gbs = std::strtod(argv[++i], nullptr);
+		else if (std::strcmp(argv[i], "--peak-gflops") == 0 && i + 1 < argc)
+			peak_gflops = std::strtod(argv[++i], nullptr);
+		else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+			++i;
+			int f = FRAME_PPM;
+			while (f < FRAME_FORMATS && std::strcmp(argv[i], frame_format_names[f]) != 0)
+				++f;
+			if (f == FRAME_FORMATS) {
+				std::cerr << "unknown export format " << argv[i] << ", it is one of";
+				for (const char* name : frame_format_names)
+					std::cerr << " " << name;
+				std::cerr << std::endl;
+				return 1;
+			}
+			export_format = (frame_format_t) f;
+		} else if (std::strcmp(argv[i], "--export-cmap") == 0 && i + 1 < argc) {
+			++i;
+			int c = COLORMAP_HSV;
+			while (c < COLORMAP_COUNT && std::strcmp(argv[i], colormap_names[c]) != 0)
+				++c;
+			if (c == COLORMAP_COUNT) {
+				std::cerr << "unknown colormap " << argv[i] << ", it is one of";
+				for (const char* name : colormap_names)
+					std::cerr << " " << name;
+				std::cerr << std::endl;
+				return 1;
+			}
+			export_cmap = (colormap_kind_t) c;
+		}
+	}
+
+	// the size of the grid is the one of the config unless --nx and --ny are given
+	if (config) {
+		if (!g_config.load(config))
+			return 1;
+		g_use_config = true;
+	}
+	if (ensemble) {
+		if (!g_config.loadMembers(ensemble, g_members))
+			return 1;
+		g_member = std::min<int>(g_member, g_members.size() - 1);
+		g_use_config = true;
+	}
+	if (g_use_amr && (g_use_config || g_use_uniform)) {
+		std::cerr << "--amr refines the plate of Heat2d.h, not a config, an ensemble or a uniform plate" << std::endl;
+		return 1;
+	}
+	if (Nx == 0)
+		Nx = g_use_config ? g_config.nx : NX;
+	if (Ny == 0)
+		Ny = g_use_config ? g_config.ny : NY;
 
 	Mtrix M;
 
-	initMatrix(M, Nx, Ny);
-	plot(M, &Nx, &Ny);
+	reset(M, Nx, Ny);
+	g_perf.init({"GM2 copy", "row sweep", "column sweep", "colorize", "draw lists", "render + swap"}, 3, omp_get_max_threads());
+
+	// frames are colored and encoded on a writer thread, the solver only queues copies of the field
+	if (export_format != FRAME_FORMATS) {
+		std::string out = export_out ? export_out : export_format == FRAME_RAW ? std::string("frames.rgb")
+										  : std::string("frame_%06ld.") + frame_format_names[export_format];
+		colormap_t cmap;
+		cmap.build(export_cmap, min, max);
+		if (!g_export.open(export_format, out, cmap, export_queue))
+			return 1;
+		g_export_every = export_every;
+	}
+	if (history) {
+		if (!g_history.open(history, history_keyframe, history_queue))
+			return 1;
+		g_history_every = history_every;
+	}
+
+	if (headless_steps > 0) {
+		// the hardware counters of the solver phases, the copy does no flops
+		if (counters) {
+			if (peak_gbs <= 0)
+				peak_gbs = triadBandwidth();
+			g_counters.init({"GM2 copy", "row sweep", "column sweep"}, {0, SWEEP_FLOPS, SWEEP_FLOPS}, omp_get_max_threads());
+		}
+
+		// the field before the last step, for the change of that step
+		Mtrix prev;
+		double t = omp_get_wtime();
+		for (int s = 0; s < headless_steps; ++s) {
+			if (s == headless_steps - 1)
+				prev = M;
+			step(M);
+		}
+		t = omp_get_wtime() - t;
+		std::cout << headless_steps << " steps in " << t << " s, " << headless_steps / t << " steps/s, kernels: "
+				  << isa_names[isaSelected()] << std::endl;
+		if (!g_members.empty())
+			std::cout << "ensemble of " << g_members.size() << " members in " << g_ensemble.blocks << " blocks of "
+					  << g_ensemble.lanes << " lanes, " << g_members.size() * headless_steps / t << " member steps/s"
+					  << std::endl;
+		if (g_use_amr)
+			std::cout << g_amr.patches.size() << " patches refined " << g_amr.ratio << " times, covering "
+					  << g_amr.coverage() * 100 << " % of the fine grid" << std::endl;
+		std::cout << "rms change of the last step: " << stepChange(M, prev) << std::endl;
+
+		if (counters) {
+			g_counters.report(stdout, peak_gbs, peak_gflops);
+			g_counters.release();
+		}
+	} else {
+		plot(M, &Nx, &Ny);
+	}
 
+	g_export.close();
+	TRACE_DUMP("tdma_2d_trace.json", 0);
+	if (g_export_every > 0)
+		std::cout << "frames written: " << g_export.written << ", failed: " << g_export.failed
+				  << ", solver stalled on the queue: " << g_export.stalled << " s" << std::endl;
+
+	g_history.close();
+	if (g_history_every > 0)
+		std::cout << "history frames: " << g_history.index.size() << ", failed: " << g_history.failed << ", "
+				  << g_history.raw_bytes / double(1 << 20) << " MB packed to " << g_history.packed_bytes / double(1 << 20)
+				  << " MB, solver stalled on the queue: " << g_history.stalled << " s" << std::endl;
 }
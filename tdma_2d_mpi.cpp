@@ -20,6 +20,9 @@
 #include "cmath"
 #include "iomanip"
 #include "cstring"
+#include "algorithm"
+#include "fstream"
+#include "climits"
 
 #include "imgui.h"
 #include "include/imgui_impl_sdl2.h"
@@ -28,46 +31,93 @@
 #include <SDL2/SDL_opengl.h>
 
 #include "include/Matrix.h"
+#include "include/Heatmap.h"
+#include "include/Downsample.h"
+#include "include/Profile.h"
+#include "include/FrameWriter.h"
+#include "include/History.h"
+#include "include/Trace.h"
+#include "include/Isa.h"
+#include "include/Config.h"
+#include "omp.h"
 
-// define the initial width and height of the matrix, this can be changed at runtime
-#define NX  200
-#define NY	100
-
-// define the intervals for x and y
-#define LX0 0
-#define LXn 1.0f
-#define LY0 0
-#define LYn 0.5f
-
-// define the border values
-#define F(x) (0)
-#define LMD(x,y) ( (x >= 0.25f && x <= 0.65f && y >= 0.1f && y <= 0.25f) ? 1e-3 : 1e-4 )
-#define X0(y) (600)
-#define XN(y) (1200)
-#define Y0(x) (600 * (1 + x))
-#define YN(x) (600 * (1 + x * x))
-
-// define the initial values for the matrix
-#define FT0(x, y) 	(300)
-
-// define the coordinates x and y from the indexes i and j
-#define X(i, dx)	data_t(LX0 + i * dx)
-#define Y(j, dy)	data_t(LY0 + j * dy)
-
-// define the increment of time delta_t
-#define DT 0.01f;
+// define the coordinates x and y from the indexes i and j, the nodes of the axes on a stretched grid
+#define X(i, dx)	data_t(g_nodes_x.empty() ? g_config.lx0 + (i) * (dx) : g_nodes_x[i])
+#define Y(j, dy)	data_t(g_nodes_y.empty() ? g_config.ly0 + (j) * (dy) : g_nodes_y[j])
 
 
 // define the data type for the matrix
 using data_t = double;
 
-// define the interval for the s component in HSV colors
+// define the interval of values the colormap spans
 const float max = 1000, min = 0;
 
 // using two matrices as buffers
 using Mtrix = matrix_t<data_t>;
 Mtrix GM2;
 int g_world_size;
+int g_world_rank;
+
+// the plate, the one of Heat2d.h or the one of --config, and the problem it is lowered to for the slab of this rank:
+// g_stretched when the config clusters the nodes, with the nodes of the whole axes in g_nodes_x and g_nodes_y
+plate_config_t g_config;
+config_problem_t<data_t> g_table;
+config_problem_t<data_t, stretched_grid_t> g_stretched;
+std::vector<double> g_nodes_x, g_nodes_y;
+
+// the global size of the grid, and the first global row of the slab owned by this rank
+size_t g_nx = g_config.nx, g_ny = g_config.ny;
+size_t g_row0 = 0;
+
+// the steps done so far
+long g_step = 0;
+
+// the commands rank 0 broadcasts to every rank, a worker runs until it receives CMD_SHUTDOWN
+enum opcode_t { CMD_STEP, CMD_RESIZE, CMD_VIEW, CMD_SNAPSHOT, CMD_CHECKPOINT, CMD_SHUTDOWN };
+struct command_t {
+	int op;
+	int arg[3];
+};
+
+// node 0 only receives the field reduced to the resolution it is drawn at, full resolution is for snapshots
+size_t g_view_w = 1280, g_view_h = 720;
+reduce_t g_view_op = REDUCE_MEAN;
+Mtrix g_view;
+
+// the grid is gathered every g_export_every steps and handed to the frame writer of node 0, 0 exports nothing
+frame_writer_t<data_t> g_export;
+int g_export_every = 0;
+
+// the field is appended to the compressed history every g_history_every steps, 0 keeps no history
+history_writer_t<data_t> g_history;
+int g_history_every = 0;
+
+// node 0 has every rank write a checkpoint every g_checkpoint_every steps, 0 only on the button of the window
+int g_checkpoint_every = 0;
+
+// the rows owned by every rank and the global row each slab starts at
+std::vector<int> g_counts, g_displs;
+
+// how the ghost rows are exchanged: messages only, direct loads from the slabs of the ranks on the same node,
+// or one sided puts into the slabs of the neighbours synchronized with fences or post-start-complete-wait
+enum halo_t { HALO_P2P, HALO_SHM, HALO_RMA_FENCE, HALO_RMA_PSCW };
+const char* g_halo_names[] = {"p2p", "shm", "rma-fence", "rma-pscw"};
+halo_t g_halo = HALO_P2P;
+
+// the ranks sharing this node, the slab window and the node ranks of the neighbours on this node
+MPI_Comm g_node_comm = MPI_COMM_NULL;
+MPI_Win g_slab_win = MPI_WIN_NULL;
+MPI_Group g_nb_group = MPI_GROUP_NULL;
+int g_shm_up = MPI_PROC_NULL, g_shm_down = MPI_PROC_NULL;
+data_t *g_shm_up_ptr = nullptr, *g_shm_down_ptr = nullptr;
+
+// the per step breakdown of the time and traffic of this rank, enabled with --profile
+profiler_t g_prof;
+
+// rebalance the slabs every g_balance_every steps using the measured busy time of each rank
+bool g_balance = false;
+int g_balance_every = 50;
+double g_busy_time = 0;
 
 // helper functions for visualization
 double mapValInterval(float iMin, float iMax, float jMin, float jMax, float val) {
@@ -76,24 +126,6 @@ double mapValInterval(float iMin, float iMax, float jMin, float jMax, float val)
 	return (val - iMin) * (jMax - jMin) / (iMax - iMin) + jMin;
 }
 
-ImU32 mapValueToColor(float value) {
-
-	float normalizedValue;
-	if (max != min)
-		normalizedValue = (value - min) / (max - min);
-	else
-		normalizedValue = 0.0f;
-
-	float r,g,b,h,s,v;
-
-	h = 0.1;
-	s = normalizedValue;
-	v = 0.5f;
-
-	ImGui::ColorConvertHSVtoRGB(h,s,v, r,g,b);
-	return ImGui::ColorConvertFloat4ToU32({r,g,b,1.0f});
-}
-
 // print the values to the terminal for debugging
 void printMatrix(Mtrix& M) {
 
@@ -109,62 +141,89 @@ void printMatrix(Mtrix& M) {
 
 }
 
-// create a matrix and fill it with initial and border values
-void initMatrix(Mtrix& M, size_t Nx, size_t Ny) {
+// fill the rows of M, which start at the global row row0, with initial and border values
+void initRows(Mtrix& M, size_t Nx, size_t Ny, size_t row0) {
+	TRACE_ZONE("initRows");
 
-	M.init(Nx, Ny);
+	data_t dx = (data_t)(g_config.lxn - g_config.lx0) / (data_t)Nx;
+	data_t dy = (data_t)(g_config.lyn - g_config.ly0) / (data_t)Ny;
+	const polynomial_boundary_t& border = g_table.boundary;
 
-	data_t dx = (LXn - LX0) / (data_t)Nx;
-	data_t dy = (LYn - LY0) / (data_t)Ny;
-	(void) dy; (void) dx;
+	for (size_t i = 0; i < M.N() + 2; ++i) {
+		size_t gi = row0 + i;
 
+		// fill in initial values for x = 0 and x = n
+		if (gi == 0 || gi == Nx + 1) {
+			for (size_t j = 0; j < Ny + 2; ++j)
+				M[i][j] = gi == 0 ? border.x0(Y(j, dy)) : border.xn(Y(j, dy));
+			continue;
+		}
 
-	// fill in initial values for x = 0 and x = n
-	for (size_t i = 0; i < Ny + 2; ++i) {
-		M[0][i] = X0(Y(i, dy));
-		M[Nx + 1][i] = XN(Y(i, dy));
-	}
+		// fill in initial values for y = 0 and y = m
+		M[i][0] = border.y0(X(gi, dx));
+		M[i][Ny + 1] = border.yn(X(gi, dx));
 
-	// fill in initial values for y = 0 and y = m
-	for (uint i = 1; i < M.N() + 1; ++i) {
-		M[i][0] = Y0(X(i, dx));
-		M[i][Ny + 1] = YN(X(i, dx));
+		// fill in matrix with init values
+		for (size_t j = 1; j < Ny + 1; ++j)
+			M[i][j] = border.t0(X(gi, dx), Y(j, dy));
 	}
+}
 
-	// fill in matrix with init values
-	for (size_t i = 1; i < Nx + 1; ++i) {
-		for (size_t j = 1; j < Ny + 1; ++j) {
-			M[i][j] = FT0(X(i, dx), Y(j, dy));
-		}
+// lower the plate for the slab of this rank in a grid of g_nx x Ny cells. g_table always gets the borders and the time
+// step initRows reads, the faces and the grid go to g_stretched when the config clusters the nodes
+void lowerSlab(size_t Ny) {
+	if (g_config.stretched()) {
+		g_config.lower(g_stretched, g_nx, Ny, g_row0, g_counts[g_world_rank]);
+		g_config.lowerBorders(g_table);
+		g_nodes_x = g_config.axis(g_config.lx0, g_config.lxn, g_nx, g_config.cluster_x);
+		g_nodes_y = g_config.axis(g_config.ly0, g_config.lyn, Ny, g_config.cluster_y);
+	} else {
+		g_config.lower(g_table, g_nx, Ny, g_row0, g_counts[g_world_rank]);
 	}
+}
 
-	GM2 = M;
+// create a matrix and fill it with initial and border values
+void initMatrix(Mtrix& M, size_t Nx, size_t Ny) {
+	TRACE_ZONE("initMatrix");
+
+	M.init(Nx, Ny);
+	initRows(M, Nx, Ny, 0);
 }
 
 // calculate the values of a given row in the matrix
-void calculateFixRow(Mtrix& M, int row, Mtrix& M2) {
+template <typename P>
+void calculateFixRow(const P& problem, Mtrix& M, int row, Mtrix& M2) {
 
-	data_t dt = DT;
+	data_t dt = problem.dt;
 
 	std::vector<data_t> v_alph(M.M() + 2);
 	std::vector<data_t> v_beta(M.M() + 2);
 
-	data_t dx = (LXn - LX0) / M.N();
-	data_t dy = (LYn - LY0) / M.M();
-
-	auto lpi2 = [&](int j) {return (data_t)(LMD(X(row + 1, dx), Y(j, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-	auto lmi2 = [&](int j) {return (data_t)(LMD(X(row - 1, dx), Y(j, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-	auto lpj2 = [&](int j) {return (data_t)(LMD(X(row , dx), Y(j + 1, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-	auto lmj2 = [&](int j) {return (data_t)(LMD(X(row, dx), Y(j - 1, dy)) + LMD(X(row, dx), Y(j, dy))) / 2;};
-
-	auto Ai =  [&](int j) {return (data_t)(- lmj2(j) / (2 * dy * dy));};
-	auto Bi =  [&](int j) {return (data_t)(- lpj2(j) / (2 * dy * dy));};
+	// the slab holds the rows starting at g_row0 of a g_nx rows grid, its faces and its grid are those of the slab
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / g_nx;
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / M.M();
+	const face_conductivity_t<data_t>& faces = problem.conductivity;
+
+	auto lpi2 = [&](int j) {return faces.face(row + 1, j, row, j);};
+	auto lmi2 = [&](int j) {return faces.face(row - 1, j, row, j);};
+	auto lpj2 = [&](int j) {return faces.face(row, j + 1, row, j);};
+	auto lmj2 = [&](int j) {return faces.face(row, j - 1, row, j);};
+
+	auto Ai =  [&](int j) {
+		if constexpr (P::is_uniform_grid) return (data_t)(- lmj2(j) / (2 * dy * dy));
+		else return (data_t)(- lmj2(j) * problem.grid.ym[j] / 2); };
+	auto Bi =  [&](int j) {
+		if constexpr (P::is_uniform_grid) return (data_t)(- lpj2(j) / (2 * dy * dy));
+		else return (data_t)(- lpj2(j) * problem.grid.yp[j] / 2); };
 	auto Ci =  [&](int j) {return (data_t)((1 / dt - Ai(j) - Bi(j)));};
 	auto Di =  [&](int j) {
 		double d1 = lpi2(j) * (M[row + 1][j] - M[row][j]);
-		double d2 = lmi2(j) * (M[row][j] - M[row][j - 1]);
+		double d2 = lmi2(j) * (M[row][j] - M[row - 1][j]);
 		double d3 = M[row][j] / dt;
-		return (data_t)(d3 + (d1 - d2) / (dx * dx)); };
+		if constexpr (P::is_uniform_grid)
+			return (data_t)(d3 + (d1 - d2) / (2 * dx * dx));
+		else
+			return (data_t)(d3 + (d1 * problem.grid.xp[row] - d2 * problem.grid.xm[row]) / 2); };
 
 
 	v_alph[0] = 0.0f;
@@ -178,61 +237,119 @@ void calculateFixRow(Mtrix& M, int row, Mtrix& M2) {
 
 	// backward substitution
 	for (size_t i = M.M(); i > 0; --i) {
-		M2[row][i] = v_alph[i] * M[row][i + 1] + v_beta[i];
+		M2[row][i] = v_alph[i] * M2[row][i + 1] + v_beta[i];
 	}
 }
 
-// calculate the values of a given column in the matrix
-void calculateFixCol(Mtrix& M, int col, Mtrix& M2) {
-
-	data_t dt = DT;
-
-	std::vector<data_t> v_alph(M.N() + 2);
-	std::vector<data_t> v_beta(M.N() + 2);
-
-	data_t dx = (LXn - LX0) / M.N();
-	data_t dy = (LYn - LY0) / M.M();
-
-	auto lpi2 = [&](int i) {return (data_t)(LMD(X(i + 1, dx), Y(col, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-	auto lmi2 = [&](int i) {return (data_t)(LMD(X(i - 1, dx), Y(col, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-	auto lpj2 = [&](int i) {return (data_t)(LMD(X(i, dx), Y(col + 1, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-	auto lmj2 = [&](int i) {return (data_t)(LMD(X(i, dx), Y(col - 1, dy)) + LMD(X(i, dx), Y(col, dy))) / 2;};
-
-	auto Ai =  [&](int i) {return (data_t)(-lmi2(i) / (2 * dx * dx));};
-	auto Bi =  [&](int i) {return (data_t)(-lpi2(i) / (2 * dx * dx));};
-	auto Ci =  [&](int i) {return (data_t)((1 / dt) - Ai(i) - Bi(i));};
-	auto Di =  [&](int i) {
-		double d1 = lpj2(i) * (M[i][col + 1] - M[i][col]);
-		double d2 = lmj2(i) * (M[i][col] - M[i][col - 1]);
+// calculate the values of the columns [col0, col1) of the matrix. the columns are the inner loops, so that the loads are
+// contiguous and the recurrences of neighbouring columns run in the lanes of a vector
+template <typename P>
+void calculateFixCols(const P& problem, Mtrix& M, size_t col0, size_t col1, Mtrix& M2, std::vector<data_t>& work) {
+
+	data_t dt = problem.dt;
+
+	size_t w = col1 - col0;
+	work.resize(2 * (M.N() + 2) * w);
+	data_t* v_alph = work.data();
+	data_t* v_beta = v_alph + (M.N() + 2) * w;
+
+	// the slab holds the rows starting at g_row0 of a g_nx rows grid, its faces and its grid are those of the slab
+	data_t dx = (data_t)(problem.lxn - problem.lx0) / g_nx;
+	data_t dy = (data_t)(problem.lyn - problem.ly0) / M.M();
+	const face_conductivity_t<data_t>& faces = problem.conductivity;
+
+	auto lpi2 = [&](int i, int col) {return faces.face(i + 1, col, i, col);};
+	auto lmi2 = [&](int i, int col) {return faces.face(i - 1, col, i, col);};
+	auto lpj2 = [&](int i, int col) {return faces.face(i, col + 1, i, col);};
+	auto lmj2 = [&](int i, int col) {return faces.face(i, col - 1, i, col);};
+
+	auto Ai =  [&](int i, int col) {
+		if constexpr (P::is_uniform_grid) return (data_t)(-lmi2(i, col) / (2 * dx * dx));
+		else return (data_t)(-lmi2(i, col) * problem.grid.xm[i] / 2); };
+	auto Bi =  [&](int i, int col) {
+		if constexpr (P::is_uniform_grid) return (data_t)(-lpi2(i, col) / (2 * dx * dx));
+		else return (data_t)(-lpi2(i, col) * problem.grid.xp[i] / 2); };
+	auto Ci =  [&](int i, int col) {return (data_t)((1 / dt) - Ai(i, col) - Bi(i, col));};
+	auto Di =  [&](int i, int col) {
+		double d1 = lpj2(i, col) * (M[i][col + 1] - M[i][col]);
+		double d2 = lmj2(i, col) * (M[i][col] - M[i][col - 1]);
 		double d3 = M[i][col] / dt;
-		return (data_t)(d3 + (d1 - d2) / (dy * dy)); };
+		if constexpr (P::is_uniform_grid)
+			return (data_t)(d3 + (d1 - d2) / (2 * dy * dy));
+		else
+			return (data_t)(d3 + (d1 * problem.grid.yp[col] - d2 * problem.grid.ym[col]) / 2); };
 
 
-	v_alph[0] = 0.0f;
-	v_beta[0] = M[1][col];
+	for (size_t c = 0; c < w; ++c) {
+		v_alph[c] = 0.0f;
+		v_beta[c] = M[0][col0 + c];
+	}
 
 	// forward substitution
 	for (size_t i = 1; i < M.N() + 2; ++i) {
-		v_alph[i] = -Bi(i) / (Ci(i) + Ai(i) * v_alph[i - 1]);
-		v_beta[i] = (Di(i) - Ai(i) * v_beta[i - 1]) / (Ci(i) + Ai(i) * v_alph[i - 1]);
+		data_t* alph = v_alph + i * w;
+		data_t* beta = v_beta + i * w;
+		const data_t* prev_alph = alph - w;
+		const data_t* prev_beta = beta - w;
+#pragma omp simd
+		for (size_t c = 0; c < w; ++c) {
+			int col = col0 + c;
+			alph[c] = -Bi(i, col) / (Ci(i, col) + Ai(i, col) * prev_alph[c]);
+			beta[c] = (Di(i, col) - Ai(i, col) * prev_beta[c]) / (Ci(i, col) + Ai(i, col) * prev_alph[c]);
+		}
 	}
 
 	// backward substitution
 	for (size_t i = M.N(); i > 0; --i) {
-		M2[i][col] = v_alph[i] * M[i + 1][col] + v_beta[i];
+		const data_t* alph = v_alph + i * w;
+		const data_t* beta = v_beta + i * w;
+		const data_t* next = M2[i + 1] + col0;
+		data_t* out = M2[i] + col0;
+#pragma omp simd
+		for (size_t c = 0; c < w; ++c)
+			out[c] = alph[c] * next[c] + beta[c];
 	}
 }
 
+// the columns solved together, a cache line of doubles and a vector of 8 doubles on AVX-512
+#define SWEEP_BLOCK 8
+
+// the sweeps of the slab as orphaned worksharing loops, dispatched to the instruction set of the cpu (see Isa.h)
+template <typename P>
+void sweepRowsKernel(const P& problem, Mtrix& M, Mtrix& M2) {
+	TRACE_ZONE("row sweep batch");
+#pragma omp for nowait
+	for (size_t i = 1; i < M.N() + 1; ++i)
+		calculateFixRow(problem, M, i, M2);
+}
+
+template <typename P>
+void sweepColsKernel(const P& problem, Mtrix& M2, Mtrix& M) {
+	TRACE_ZONE("column sweep batch");
+	std::vector<data_t> work;
+	size_t blocks = (M2.M() + SWEEP_BLOCK - 1) / SWEEP_BLOCK;
+#pragma omp for nowait
+	for (size_t b = 0; b < blocks; ++b) {
+		size_t j0 = 1 + b * SWEEP_BLOCK;
+		calculateFixCols(problem, M2, j0, std::min(j0 + SWEEP_BLOCK, M2.M() + 1), M, work);
+	}
+}
+
+ISA_DISPATCH(sweepRows, sweepRowsKernel)
+ISA_DISPATCH(sweepCols, sweepColsKernel)
+
 // calculate the values of each row then each column
-void calculate(Mtrix& M) {
+template <typename P>
+void calculate(const P& problem, Mtrix& M) {
+	TRACE_ZONE("calculate");
 
 	GM2 = M;
 
-	for (size_t i = 1; i < M.N() + 1; ++i)
-		calculateFixRow(M, i, GM2);
+#pragma omp parallel
+	sweepRows(problem, M, GM2);
 
-	for (size_t j = 1; j < M.M() + 1; ++j)
-		calculateFixCol(GM2, j, M);
+#pragma omp parallel
+	sweepCols(problem, GM2, M);
 }
 
 // initialize imgui with SDL
@@ -299,61 +416,563 @@ void freeImGui(SDL_Window** window, SDL_GLContext* gl_context) {
 	SDL_Quit();
 }
 
-// divide the workload on the nodes of the comm and read results from node 0
-void scatter(Mtrix& M) {
-	int	begin;
-	int cols = NY + 2;
-	int rows = NX / (g_world_size - 1) + 2;
+// split Nx rows over the ranks proportionally to weights, the remainder rows go to the first ranks
+void decompose(size_t Nx, const std::vector<double>& weights) {
+	double total = 0;
+	for (double w : weights)
+		total += w;
+
+	g_counts.assign(g_world_size, 1);
+	g_displs.assign(g_world_size, 0);
+
+	// every rank keeps at least one row, the rest is shared by weight
+	size_t left = Nx - g_world_size;
+	size_t given = 0;
+	std::vector<std::pair<double, int>> rest(g_world_size);
+	for (int r = 0; r < g_world_size; ++r) {
+		double share = left * weights[r] / total;
+		g_counts[r] += (int) share;
+		given += (size_t) share;
+		rest[r] = {share - std::floor(share), -r};
+	}
+
+	// hand out the rows lost to rounding to the largest remainders, lower ranks first on ties
+	std::sort(rest.begin(), rest.end(), std::greater<>());
+	for (size_t k = 0; given < left; ++k, ++given)
+		g_counts[-rest[k % g_world_size].second] += 1;
+
+	for (int r = 1; r < g_world_size; ++r)
+		g_displs[r] = g_displs[r - 1] + g_counts[r - 1];
+
+	g_row0 = g_displs[g_world_rank];
+}
+
+// split off the ranks sharing this node and find which of the neighbouring ranks are among them
+void initNodeComm() {
+	MPI_Group world_group, node_group;
+	int nb[2] = {g_world_rank > 0 ? g_world_rank - 1 : MPI_PROC_NULL,
+				 g_world_rank < g_world_size - 1 ? g_world_rank + 1 : MPI_PROC_NULL};
+	int node_nb[2];
+
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, g_world_rank, MPI_INFO_NULL, &g_node_comm);
+	MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+	MPI_Comm_group(g_node_comm, &node_group);
+	MPI_Group_translate_ranks(world_group, 2, nb, node_group, node_nb);
+	MPI_Group_free(&world_group);
+	MPI_Group_free(&node_group);
+
+	g_shm_up = node_nb[0] == MPI_UNDEFINED ? MPI_PROC_NULL : node_nb[0];
+	g_shm_down = node_nb[1] == MPI_UNDEFINED ? MPI_PROC_NULL : node_nb[1];
+}
+
+// the group of the neighbouring ranks, the origins and targets of the puts in the pscw mode
+void initNbGroup() {
+	MPI_Group world_group;
+	int nb[2], n = 0;
+
+	if (g_world_rank > 0)
+		nb[n++] = g_world_rank - 1;
+	if (g_world_rank < g_world_size - 1)
+		nb[n++] = g_world_rank + 1;
+
+	MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+	MPI_Group_incl(world_group, n, nb, &g_nb_group);
+	MPI_Group_free(&world_group);
+}
+
+// release the slab and the MPI window it lives in
+void freeSlab(Mtrix& subM) {
+	subM.clear();
+	if (g_slab_win == MPI_WIN_NULL)
+		return;
+
+	if (g_halo == HALO_SHM)
+		MPI_Win_unlock_all(g_slab_win);
+	MPI_Win_free(&g_slab_win);
+}
+
+// allocate the slab, inside an MPI window when the neighbours access it directly
+void allocSlab(Mtrix& subM, size_t rows, size_t cols) {
+	if (g_halo == HALO_P2P) {
+		subM.init(rows, cols);
+		return;
+	}
+
+	freeSlab(subM);
+
+	data_t *base;
+	MPI_Aint size = (rows + 2) * (cols + 2) * sizeof(data_t);
+
+	// the neighbours put their border rows into our ghost rows
+	if (g_halo != HALO_SHM) {
+		MPI_Win_allocate(size, sizeof(data_t), MPI_INFO_NULL, MPI_COMM_WORLD, &base, &g_slab_win);
+		subM.attach(base, rows, cols);
+		return;
+	}
+
+	// let every rank keep its slab in its own numa domain
+	MPI_Info info;
+	MPI_Info_create(&info);
+	MPI_Info_set(info, "alloc_shared_noncontig", "true");
+
+	MPI_Win_allocate_shared(size, sizeof(data_t), info, g_node_comm, &base, &g_slab_win);
+	MPI_Info_free(&info);
+	subM.attach(base, rows, cols);
+
+	// a single passive epoch for the whole run, the accesses are ordered with MPI_Win_sync
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, g_slab_win);
+
+	MPI_Aint nb_size;
+	int disp_unit;
+	g_shm_up_ptr = g_shm_down_ptr = nullptr;
+	if (g_shm_up != MPI_PROC_NULL)
+		MPI_Win_shared_query(g_slab_win, g_shm_up, &nb_size, &disp_unit, &g_shm_up_ptr);
+	if (g_shm_down != MPI_PROC_NULL)
+		MPI_Win_shared_query(g_slab_win, g_shm_down, &nb_size, &disp_unit, &g_shm_down_ptr);
+}
+
+// make the slab stores visible and wait for the neighbours on this node to reach the same point
+void shmSync() {
+	prof_scope_t p(g_prof, PROF_WAIT);
+
+	MPI_Win_sync(g_slab_win);
+	MPI_Sendrecv(nullptr, 0, MPI_BYTE, g_shm_up, 2, nullptr, 0, MPI_BYTE, g_shm_down, 2, g_node_comm, MPI_STATUS_IGNORE);
+	MPI_Sendrecv(nullptr, 0, MPI_BYTE, g_shm_down, 3, nullptr, 0, MPI_BYTE, g_shm_up, 3, g_node_comm, MPI_STATUS_IGNORE);
+	MPI_Win_sync(g_slab_win);
+}
+
+// put the border rows of the slab into the ghost rows of the neighbouring slabs
+void exchangeRma(Mtrix& subM) {
+	int cols = subM.M() + 2;
+	int rows = subM.N();
+	int up = g_world_rank - 1;
+	int down = g_world_rank + 1;
+
+	// the neighbours must be done with the ghost rows of the last step before they are overwritten
+	{
+		prof_scope_t p(g_prof, PROF_WAIT);
+		if (g_halo == HALO_RMA_FENCE) {
+			MPI_Win_fence(MPI_MODE_NOPRECEDE, g_slab_win);
+		} else {
+			MPI_Win_post(g_nb_group, 0, g_slab_win);
+			MPI_Win_start(g_nb_group, 0, g_slab_win);
+		}
+	}
+
+	{
+		prof_scope_t p(g_prof, PROF_SEND, ((up >= 0) + (down < g_world_size)) * cols * sizeof(data_t));
+		if (up >= 0)
+			MPI_Put(subM[1], cols, MPI_DOUBLE, up, (g_counts[up] + 1) * cols, cols, MPI_DOUBLE, g_slab_win);
+		if (down < g_world_size)
+			MPI_Put(subM[rows], cols, MPI_DOUBLE, down, 0, cols, MPI_DOUBLE, g_slab_win);
+	}
+
+	prof_scope_t p(g_prof, PROF_WAIT);
+	if (g_halo == HALO_RMA_FENCE) {
+		MPI_Win_fence(MPI_MODE_NOSTORE | MPI_MODE_NOSUCCEED, g_slab_win);
+	} else {
+		MPI_Win_complete(g_slab_win);
+		MPI_Win_wait(g_slab_win);
+	}
+}
+
+// exchange the ghost rows of the slab with the neighbouring ranks
+void exchange(Mtrix& subM) {
+	TRACE_ZONE("exchange");
+	if (g_halo == HALO_RMA_FENCE || g_halo == HALO_RMA_PSCW) {
+		exchangeRma(subM);
+		return;
+	}
+
+	int cols = subM.M() + 2;
+	int rows = subM.N();
+	int up = g_world_rank > 0 ? g_world_rank - 1 : MPI_PROC_NULL;
+	int down = g_world_rank < g_world_size - 1 ? g_world_rank + 1 : MPI_PROC_NULL;
+
+	// copy the rows of the neighbours on this node straight out of their slabs
+	if (g_halo == HALO_SHM) {
+		shmSync();
+		prof_scope_t p(g_prof, PROF_RECV, 0, (!!g_shm_up_ptr + !!g_shm_down_ptr) * cols * sizeof(data_t));
+		if (g_shm_up_ptr) {
+			std::memcpy(subM[0], g_shm_up_ptr + g_counts[up] * cols, cols * sizeof(data_t));
+			up = MPI_PROC_NULL;
+		}
+		if (g_shm_down_ptr) {
+			std::memcpy(subM[rows + 1], g_shm_down_ptr + cols, cols * sizeof(data_t));
+			down = MPI_PROC_NULL;
+		}
+	}
+
+	// the first and last ghost rows of the grid are borders and are never overwritten
+	uint64_t bytes = ((up != MPI_PROC_NULL) + (down != MPI_PROC_NULL)) * cols * sizeof(data_t);
+	MPI_Request req[4];
+	{
+		prof_scope_t p(g_prof, PROF_SEND, bytes);
+		MPI_Irecv(subM[rows + 1], cols, MPI_DOUBLE, down, 0, MPI_COMM_WORLD, &req[0]);
+		MPI_Irecv(subM[0], cols, MPI_DOUBLE, up, 1, MPI_COMM_WORLD, &req[1]);
+		MPI_Isend(subM[1], cols, MPI_DOUBLE, up, 0, MPI_COMM_WORLD, &req[2]);
+		MPI_Isend(subM[rows], cols, MPI_DOUBLE, down, 1, MPI_COMM_WORLD, &req[3]);
+	}
+	{
+		prof_scope_t p(g_prof, PROF_RECV, 0, bytes);
+		MPI_Waitall(4, req, MPI_STATUSES_IGNORE);
+	}
+
+	// the neighbours must not overwrite their rows before we are done reading them
+	if (g_halo == HALO_SHM)
+		shmSync();
+}
+
+// send the slabs of the matrix M on node 0 to their ranks
+void scatter(Mtrix& M, Mtrix& subM) {
+	TRACE_ZONE("scatter");
+	int cols = subM.M() + 2;
+	std::vector<int> counts(g_world_size), displs(g_world_size);
 
-	// sending workloads
-	begin = 0;
-	for (int i = 1; i < g_world_size; ++i) {
-		MPI_Send(M[begin], cols * rows, MPI_DOUBLE, i, 0, MPI_COMM_WORLD);
-		begin += rows - 2;
+	for (int r = 0; r < g_world_size; ++r) {
+		counts[r] = g_counts[r] * cols;
+		displs[r] = (g_displs[r] + 1) * cols;
 	}
-	MPI_Barrier(MPI_COMM_WORLD);
 
-	// receiving results
-	begin = 0;
-	for (int i = 1; i < g_world_size; ++i) {
-		MPI_Recv(M[begin + 1], (rows - 2) * cols, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-		begin += rows - 2;
+	uint64_t bytes = counts[g_world_rank] * sizeof(data_t);
+	prof_scope_t p(g_prof, g_world_rank == 0 ? PROF_SEND : PROF_RECV, (g_nx * cols * sizeof(data_t) - bytes) * (g_world_rank == 0), bytes * (g_world_rank != 0));
+	MPI_Scatterv(M.data(), counts.data(), displs.data(), MPI_DOUBLE,
+				 subM[1], counts[g_world_rank], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
+
+// collect the slabs of every rank into the matrix M on node 0
+void gather(Mtrix& subM, Mtrix& M) {
+	TRACE_ZONE("gather");
+	int cols = subM.M() + 2;
+	std::vector<int> counts(g_world_size), displs(g_world_size);
+
+	for (int r = 0; r < g_world_size; ++r) {
+		counts[r] = g_counts[r] * cols;
+		displs[r] = (g_displs[r] + 1) * cols;
 	}
-	MPI_Barrier(MPI_COMM_WORLD);
 
-	// do some preprocessing to the result before rendering with the results
-	// ...
+	uint64_t bytes = counts[g_world_rank] * sizeof(data_t);
+	prof_scope_t p(g_prof, g_world_rank == 0 ? PROF_RECV : PROF_SEND, bytes * (g_world_rank != 0), (g_nx * cols * sizeof(data_t) - bytes) * (g_world_rank == 0));
+	MPI_Gatherv(subM[1], counts[g_world_rank], MPI_DOUBLE,
+				M.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
 }
 
-// receive a workload do calculation and send the results back to node 0
-void receive(Mtrix &subM, int world_rank) {
-	int cols = NY + 2;
-	int rows = NX / (g_world_size - 1) + 2;
+// the global rows [lo, hi) of the grid a rank is responsible for, node 0 and the last rank own the border rows as well
+void ownedRows(int r, size_t& lo, size_t& hi) {
+	lo = r == 0 ? 0 : g_displs[r] + 1;
+	hi = r == g_world_size - 1 ? g_nx + 2 : g_displs[r] + g_counts[r] + 1;
+}
 
-	(void) world_rank;
-	while (true) {
-		// receiving the workload
-		MPI_Recv(subM.data(), rows * cols, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-		MPI_Barrier(MPI_COMM_WORLD);
+// reduce the slab of every rank to the resolution of the view and merge the blocks into g_view on node 0
+void gatherView(Mtrix& subM) {
+	TRACE_ZONE("gatherView");
+	size_t fx = blockCount(g_nx + 2, g_view_w), fy = blockCount(g_ny + 2, g_view_h);
+	size_t bx = blockCount(g_nx + 2, fx), by = blockCount(g_ny + 2, fy);
+	std::vector<int> counts(g_world_size), displs(g_world_size), first(g_world_size);
+	size_t lo, hi;
+
+	ownedRows(g_world_rank, lo, hi);
+	for (int r = 0, total = 0; r < g_world_size; ++r) {
+		size_t r_lo, r_hi;
+		ownedRows(r, r_lo, r_hi);
+		first[r] = r_lo / fx;
+		counts[r] = ((r_hi - 1) / fx - first[r] + 1) * by * 2;
+		displs[r] = total;
+		total += counts[r];
+	}
 
-		// do calculations
-		calculate(subM);
+	std::vector<data_t> part(counts[g_world_rank]);
+	reduceBlocks(subM, lo - g_row0, hi - g_row0, g_row0, fx, fy, g_view_op, part.data());
 
-		// send back the results
-		MPI_Send(subM[1], cols * (rows - 2), MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-		MPI_Barrier(MPI_COMM_WORLD);
+	std::vector<data_t> all(g_world_rank == 0 ? displs.back() + counts.back() : 0);
+	{
+		uint64_t bytes = part.size() * sizeof(data_t);
+		uint64_t total = (displs.back() + counts.back()) * sizeof(data_t) - bytes;
+		prof_scope_t p(g_prof, g_world_rank == 0 ? PROF_RECV : PROF_SEND, bytes * (g_world_rank != 0), total * (g_world_rank == 0));
+		MPI_Gatherv(part.data(), counts[g_world_rank], MPI_DOUBLE,
+					all.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
 	}
+	if (g_world_rank != 0)
+		return;
+
+	// the blocks on the border of two slabs are merged from both ranks
+	std::vector<data_t> acc(bx * by * 2);
+	initBlocks(acc.data(), bx * by, g_view_op);
+	for (int r = 0; r < g_world_size; ++r)
+		mergeBlocks(all.data() + displs[r], acc.data() + first[r] * by * 2, counts[r] / 2, g_view_op);
+	finishBlocks(acc.data(), bx, by, g_view_op, g_view);
+}
+
+// move the slab borders so that every rank needs about the same time per step
+void balance(Mtrix& subM, Mtrix& M) {
+	std::vector<double> times(g_world_size);
+
+	// collect the field with the old slabs, node 0 hands out the new ones from it
+	gather(subM, M);
+
+	// the measured rows per second of every rank are the weights of the new decomposition
+	double rate = g_counts[g_world_rank] / std::max(g_busy_time, 1e-9);
+	prof_scope_t p(g_prof, PROF_WAIT);
+	MPI_Allgather(&rate, 1, MPI_DOUBLE, times.data(), 1, MPI_DOUBLE, MPI_COMM_WORLD);
+	g_busy_time = 0;
+
+	std::vector<int> old = g_counts;
+	decompose(g_nx, times);
+	if (old == g_counts)
+		return;
+
+	// resize the slab, lower the plate for its rows, refill its border rows and take the new rows from node 0
+	allocSlab(subM, g_counts[g_world_rank], subM.M());
+	lowerSlab(subM.M());
+	initRows(subM, g_nx, subM.M(), g_row0);
+	scatter(M, subM);
 }
 
+// do one time step on the slab of this rank
+void step(Mtrix& subM, Mtrix& M) {
+	static double last = 0;
+
+	g_prof.next(g_step);
+
+	// the time spent outside of step (rendering on node 0) counts as busy time as well
+	double t = MPI_Wtime();
+	if (last > 0)
+		g_busy_time += t - last;
+
+	exchange(subM);
+
+	t = MPI_Wtime();
+	if (g_config.stretched())
+		calculate(g_stretched, subM);
+	else
+		calculate(g_table, subM);
+	g_busy_time += MPI_Wtime() - t;
+	g_prof.add(PROF_COMPUTE, MPI_Wtime() - t);
+
+	++g_step;
+	if (g_balance && g_step % g_balance_every == 0)
+		balance(subM, M);
+	bool frame = g_export_every > 0 && g_step % g_export_every == 0;
+	bool history = g_history_every > 0 && g_step % g_history_every == 0;
+	if (frame || history) {
+		gather(subM, M);
+		if (g_world_rank == 0 && frame)
+			g_export.push(M, g_step);
+		if (g_world_rank == 0 && history)
+			g_history.push(M, g_step);
+	}
+	last = MPI_Wtime();
+}
+
+// change the size of the grid, every rank reallocates its slab and restarts from the initial values
+void resize(Mtrix& subM, Mtrix& M, size_t Nx, size_t Ny) {
+	g_nx = Nx;
+	g_ny = Ny;
+	g_step = 0;
+
+	decompose(g_nx, std::vector<double>(g_world_size, 1.0));
+	allocSlab(subM, g_counts[g_world_rank], g_ny);
+	lowerSlab(g_ny);
+	initRows(subM, g_nx, g_ny, g_row0);
+
+	if (g_world_rank == 0)
+		initMatrix(M, g_nx, g_ny);
+}
+
+// write the matrix with its border to a binary file: nx, ny and the step, then the rows
+void writeSnapshot(Mtrix& M, const std::string& path) {
+	std::ofstream out(path, std::ios::binary);
+	uint64_t header[3] = {M.N(), M.M(), (uint64_t) g_step};
+
+	out.write((const char*) header, sizeof(header));
+	out.write((const char*) M.data(), (M.N() + 2) * (M.M() + 2) * sizeof(data_t));
+	if (!out)
+		std::cerr << "failed to write " << path << std::endl;
+}
+
+// the sizes of the file views and the counts of the MPI-IO calls are ints: the grid with its border and the slab of
+// every rank with its ghost rows must fit in them. the same on every rank, so that they all take the same branch
+bool fitsMpiIo() {
+	size_t most = *std::max_element(g_counts.begin(), g_counts.end());
+	return g_nx + 2 <= INT_MAX && g_ny + 2 <= INT_MAX && most + 2 <= INT_MAX / (g_ny + 2);
+}
+
+// set a file view on the global rows [lo, hi) of the grid stored after the header of a snapshot
+void setRowsView(MPI_File fh, size_t lo, size_t hi) {
+	int sizes[2] = {(int) g_nx + 2, (int) g_ny + 2};
+	int subsizes[2] = {(int) (hi - lo), (int) g_ny + 2};
+	int starts[2] = {(int) lo, 0};
+	MPI_Datatype rows;
+
+	MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &rows);
+	MPI_Type_commit(&rows);
+	MPI_File_set_view(fh, 3 * sizeof(uint64_t), MPI_DOUBLE, rows, "native", MPI_INFO_NULL);
+	MPI_Type_free(&rows);
+}
+
+// every rank writes its own rows of the grid to one shared file, in the same layout as writeSnapshot
+void writeCheckpoint(Mtrix& subM, const std::string& path) {
+	MPI_File fh;
+	size_t lo, hi;
+
+	if (!fitsMpiIo()) {
+		if (g_world_rank == 0)
+			std::cerr << "the grid is too large for the int counts of MPI-IO, no checkpoint written" << std::endl;
+		return;
+	}
+	if (MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+		if (g_world_rank == 0)
+			std::cerr << "failed to open " << path << std::endl;
+		return;
+	}
+	MPI_File_set_size(fh, 0);
+
+	if (g_world_rank == 0) {
+		uint64_t header[3] = {g_nx, g_ny, (uint64_t) g_step};
+		MPI_File_write_at(fh, 0, header, 3, MPI_UINT64_T, MPI_STATUS_IGNORE);
+	}
+
+	ownedRows(g_world_rank, lo, hi);
+	setRowsView(fh, lo, hi);
+	MPI_File_write_at_all(fh, 0, subM[lo - g_row0], (hi - lo) * (g_ny + 2), MPI_DOUBLE, MPI_STATUS_IGNORE);
+	MPI_File_close(&fh);
+}
+
+// restart from a checkpoint or snapshot, the grid is split over the ranks of this job whatever wrote the file. the
+// header comes from the file: the size of the grid is checked against the length of the file before anything is
+// allocated, so a truncated or foreign file is refused instead of leaving part of the slabs at their initial values
+bool readCheckpoint(Mtrix& subM, Mtrix& M, const std::string& path) {
+	MPI_File fh;
+	MPI_Offset length = 0;
+	uint64_t header[3] = {0, 0, 0};
+
+	if (MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+		if (g_world_rank == 0)
+			std::cerr << "failed to open " << path << std::endl;
+		return false;
+	}
+	auto fail = [&](const char* error) {
+		if (g_world_rank == 0)
+			std::cerr << path << " " << error << std::endl;
+		MPI_File_close(&fh);
+		return false;
+	};
+
+	MPI_File_get_size(fh, &length);
+	if (length < (MPI_Offset) sizeof(header))
+		return fail("is too short for the header of a checkpoint");
+	MPI_File_read_at_all(fh, 0, header, 3, MPI_UINT64_T, MPI_STATUS_IGNORE);
+
+	// the rows as doubles follow the header, compared by division so that no product of the header wraps
+	uint64_t values = (length - sizeof(header)) / sizeof(data_t);
+	if (header[0] < (uint64_t) g_world_size)
+		return fail("has fewer rows than there are ranks");
+	if (header[1] < 1)
+		return fail("has no columns");
+	if (header[0] > INT_MAX - 2 || header[1] > INT_MAX - 2)
+		return fail("has a grid too large for the int sizes of MPI-IO");
+	if ((length - sizeof(header)) % sizeof(data_t) != 0 || values % (header[0] + 2) != 0
+		|| values / (header[0] + 2) != header[1] + 2)
+		return fail("does not hold the (nx + 2) x (ny + 2) values its header gives");
+
+
+	// the slabs resize() will split the grid into, checked before they are allocated
+	g_nx = header[0];
+	g_ny = header[1];
+	decompose(g_nx, std::vector<double>(g_world_size, 1.0));
+	if (!fitsMpiIo())
+		return fail("has slabs too large for the int counts of MPI-IO on this many ranks");
+
+	resize(subM, M, header[0], header[1]);
+	g_step = header[2];
+
+	// every rank reads its slab with the ghost rows, so no exchange is needed before the first step
+	setRowsView(fh, g_row0, g_row0 + g_counts[g_world_rank] + 2);
+	MPI_File_read_at_all(fh, 0, subM.data(), (subM.N() + 2) * (g_ny + 2), MPI_DOUBLE, MPI_STATUS_IGNORE);
+	MPI_File_close(&fh);
+	return true;
+}
+
+// run a command on this rank, returns false once the job should shut down
+bool execute(const command_t& cmd, Mtrix& subM, Mtrix& M) {
+	switch (cmd.op) {
+		case CMD_STEP:
+			for (int k = 0; k < cmd.arg[0]; ++k)
+				step(subM, M);
+			gatherView(subM);
+			return true;
+		case CMD_RESIZE:
+			resize(subM, M, cmd.arg[0], cmd.arg[1]);
+			return true;
+		case CMD_VIEW:
+			g_view_w = std::max(8, cmd.arg[0]);
+			g_view_h = std::max(8, cmd.arg[1]);
+			g_view_op = (reduce_t) cmd.arg[2];
+			return true;
+		case CMD_SNAPSHOT:
+			gather(subM, M);
+			if (g_world_rank == 0)
+				writeSnapshot(M, "snapshot_" + std::to_string(g_step) + ".bin");
+			return true;
+		case CMD_CHECKPOINT:
+			writeCheckpoint(subM, "checkpoint_" + std::to_string(g_step) + ".bin");
+			return true;
+		default:
+			return false;
+	}
+}
+
+// broadcast a command from node 0 and run it there as well
+bool command(int op, int arg0, int arg1, Mtrix& subM, Mtrix& M, int arg2 = 0) {
+	command_t cmd = {op, {arg0, arg1, arg2}};
+
+	{
+		TRACE_ZONE("send command");
+		prof_scope_t p(g_prof, PROF_WAIT);
+		MPI_Bcast(&cmd, 4, MPI_INT, 0, MPI_COMM_WORLD);
+	}
+	return execute(cmd, subM, M);
+}
+
+// every rank other than 0 runs the commands of node 0 on its slab
+void receive(Mtrix &subM) {
+	Mtrix M;
+	command_t cmd;
+
+	do {
+		TRACE_ZONE("receive command");
+		prof_scope_t p(g_prof, PROF_WAIT);
+		MPI_Bcast(&cmd, 4, MPI_INT, 0, MPI_COMM_WORLD);
+	} while (execute(cmd, subM, M));
+}
+
+
+// run steps on every rank, with a checkpoint each time the step count reaches a multiple of g_checkpoint_every on the
+// way. the steps are counted from the one of a restart, so the checkpoints of a restarted run fall on the same steps
+void runSteps(Mtrix& subM, Mtrix& M, int steps) {
+	while (steps > 0) {
+		int n = steps;
+		if (g_checkpoint_every > 0)
+			n = std::min<long>(n, g_checkpoint_every - g_step % g_checkpoint_every);
+		command(CMD_STEP, n, 0, subM, M);
+		steps -= n;
+		if (g_checkpoint_every > 0 && g_step % g_checkpoint_every == 0)
+			command(CMD_CHECKPOINT, 0, 0, subM, M);
+	}
+}
 
 // draw the matrix to the window surface
-int plot(Mtrix& M, int* Nx, int *Ny) {
+int plot(Mtrix& M, Mtrix& subM, int* Nx, int *Ny) {
 	SDL_Window* window;
 	SDL_GLContext gl_context;
 	ImGuiWindowFlags window_flag;
 	ImVec4 clear_color;
+	static int nx_count = *Nx;
+	static int ny_count = *Ny;
+	static int steps = 1;
+	static int view_op = REDUCE_MEAN;
 	static int ti;
-	(void) Nx; (void) Ny;
+	const char* view_ops[] = {"mean", "min", "max"};
 
 	float tj = 0.0f;
 
@@ -373,6 +992,10 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 	ImGuiIO& io = ImGui::GetIO();
 	clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+	heatmap_t heatmap;
+	colormap_t cmap;
+	int cmap_kind = COLORMAP_HSV;
+	cmap.build(COLORMAP_HSV, min, max);
 
 	// Main loop
 	bool done = false;
@@ -381,6 +1004,8 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 	while (!done)
 	{
+		TRACE_ZONE("frame");
+
 		// poll sdl events
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
@@ -401,26 +1026,51 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 		// start imgui frame and add some settings to the window
 		ImGui::Begin("Plotter", NULL, window_flag);
+		ImGui::SliderInt("Nx count", &nx_count, g_world_size, 1000);
+		ImGui::SliderInt("Ny count", &ny_count, 3, 1000);
+		ImGui::SliderInt("Steps per frame", &steps, 1, 100);
 		ImGui::SliderInt("T", &ti, 0, 0);
+		ImGui::Combo("Block", &view_op, view_ops, 3);
+		if (ImGui::Combo("Colormap", &cmap_kind, colormap_names, COLORMAP_COUNT))
+			cmap.build(colormap_kind_t(cmap_kind), min, max);
+		bool snapshot = ImGui::Button("Snapshot");
+		ImGui::SameLine();
+		bool checkpoint = ImGui::Button("Checkpoint");
+
+		// let the ranks know the resolution the field is drawn at, clamped to at least 8 like execute() does so that a
+		// window smaller than the margins does not send CMD_VIEW on every frame
+		size_t view_w = std::max<size_t>(8, std::max(io.DisplaySize.x - 20, 0.0f));
+		size_t view_h = std::max<size_t>(8, std::max(io.DisplaySize.y - 90, 0.0f));
+		if (view_w != g_view_w || view_h != g_view_h || view_op != g_view_op)
+			command(CMD_VIEW, view_w, view_h, subM, M, view_op);
+
+		// resize the slabs of every rank if the dimensions were changed
+		if (nx_count != *Nx || ny_count != *Ny) {
+			*Nx = nx_count;
+			*Ny = ny_count;
+			command(CMD_RESIZE, *Nx, *Ny, subM, M);
+			ti = 0;
+			tj = 0.0f;
+		}
 
+		if (snapshot)
+			command(CMD_SNAPSHOT, 0, 0, subM, M);
+		if (checkpoint)
+			command(CMD_CHECKPOINT, 0, 0, subM, M);
 
-		// calculate a new iteration after dt
-		tj += DT;
+		// calculate new iterations after dt
+		tj += steps * g_table.dt;
 		ti = int(std::floor(tj));
 
-		// divide the workload
-		scatter(M);
-
-		// draw the matrix to the surface
-		ImDrawList* dl = ImGui::GetWindowDrawList();
-		float xi, yi;
-		for (size_t i = 0; i < M.N() + 2; ++i) {
-			xi = 20.0f + (io.DisplaySize.x - 20) / float(M.N() + 2) * i;
-			for (size_t j = 0; j < M.M() + 2; ++j) {
-				yi = 90.0f + (io.DisplaySize.y - 90) / float(M.M() + 2) * j;
-				dl->AddRectFilled({xi,yi}, {xi + (io.DisplaySize.x - 20) / float(M.N() + 2), yi + (io.DisplaySize.y - 90) / float(M.M() + 2)}, mapValueToColor(M[i][j]));
-			}
+		// rank 0 does its share of the steps before rendering the collected field
+		runSteps(subM, M, steps);
+
+		// draw the matrix to the surface as a single texture
+		{
+			TRACE_ZONE("colorize");
+			heatmap.update(g_view, cmap);
 		}
+		heatmap.draw(ImGui::GetWindowDrawList(), {20.0f, 90.0f}, {io.DisplaySize.x, io.DisplaySize.y});
 
 		// end the recording of the frame
 		ImGui::PushItemWidth(-1);
@@ -428,6 +1078,7 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 
 		// Rendering
 		ImGui::Render();
+		TRACE_ZONE("render + swap");
 		glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
 		glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
 		glClear(GL_COLOR_BUFFER_BIT);
@@ -436,40 +1087,218 @@ int plot(Mtrix& M, int* Nx, int *Ny) {
 	}
 
 	// Cleanup
+	heatmap.release();
+	command(CMD_SHUTDOWN, 0, 0, subM, M);
 	freeImGui(&window, &gl_context);
 	return 0;
 }
 
 
+// run the steps without a window, returns the seconds they took with the checkpoints written on the way
+double headless(Mtrix& subM, Mtrix& M, int steps) {
+
+	// one step first so that the slabs and windows are touched before the clock starts
+	runSteps(subM, M, 1);
+
+	double t = MPI_Wtime();
+	runSteps(subM, M, steps);
+	t = MPI_Wtime() - t;
+
+	command(CMD_SHUTDOWN, 0, 0, subM, M);
+	return t;
+}
+
+// stop all the ranks on an option value that is not one of names. every rank parses the options, the message is written
+// at once so that the lines of the ranks do not mix
+template <size_t N>
+void unknownValue(const char* what, const char* value, const char* const (&names)[N]) {
+	std::string message = std::string("unknown ") + what + " " + value + ", it is one of";
+	for (const char* name : names)
+		message += std::string(" ") + name;
+	std::cerr << message + "\n" << std::flush;
+	MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+
 // Main program
-int main() {
-	// init mpi
-	MPI_Init(NULL, NULL);
+int main(int argc, char** argv) {
+	// init mpi, only the main thread talks to mpi, the omp threads do the sweeps
+	int provided;
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
 
 	// get mpi info
-	int world_rank;
-	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+	MPI_Comm_rank(MPI_COMM_WORLD, &g_world_rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &g_world_size);
+	TRACE_THREAD("main");
+
+	const char* restart = nullptr;
+	const char* config = nullptr;
+	size_t nx = 0, ny = 0;
+	int headless_steps = 0, export_every = 10, export_queue = 8, checkpoint_every = 0;
+	int history_every = 10, history_keyframe = 16, history_queue = 8;
+	const char* history = nullptr;
+	frame_format_t export_format = FRAME_FORMATS;
+	colormap_kind_t export_cmap = COLORMAP_HSV;
+	const char* export_out = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--balance") == 0)
+			g_balance = true;
+		else if (std::strcmp(argv[i], "--balance-every") == 0 && i + 1 < argc)
+			g_balance_every = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--nx") == 0 && i + 1 < argc)
+			nx = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--ny") == 0 && i + 1 < argc)
+			ny = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+			config = argv[++i];
+		else if (std::strcmp(argv[i], "--profile") == 0)
+			g_prof.enabled = true;
+		else if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+			headless_steps = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--restart") == 0 && i + 1 < argc)
+			restart = argv[++i];
+		else if (std::strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc)
+			checkpoint_every = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--halo") == 0 && i + 1 < argc) {
+			++i;
+			int h = HALO_P2P;
+			while (h <= HALO_RMA_PSCW && std::strcmp(argv[i], g_halo_names[h]) != 0)
+				++h;
+			if (h > HALO_RMA_PSCW)
+				unknownValue("halo exchange", argv[i], g_halo_names);
+			g_halo = (halo_t) h;
+		} else if (std::strcmp(argv[i], "--export-every") == 0 && i + 1 < argc)
+			export_every = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--export-queue") == 0 && i + 1 < argc)
+			export_queue = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--export-out") == 0 && i + 1 < argc)
+			export_out = argv[++i];
+		else if (std::strcmp(argv[i], "--history") == 0 && i + 1 < argc)
+			history = argv[++i];
+		else if (std::strcmp(argv[i], "--history-every") == 0 && i + 1 < argc)
+			history_every = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--history-keyframe") == 0 && i + 1 < argc)
+			history_keyframe = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--history-queue") == 0 && i + 1 < argc)
+			history_queue = std::max(1L, std::strtol(argv[++i], nullptr, 10));
+		else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+			++i;
+			int f = FRAME_PPM;
+			while (f < FRAME_FORMATS && std::strcmp(argv[i], frame_format_names[f]) != 0)
+				++f;
+			if (f == FRAME_FORMATS)
+				unknownValue("export format", argv[i], frame_format_names);
+			export_format = (frame_format_t) f;
+		} else if (std::strcmp(argv[i], "--export-cmap") == 0 && i + 1 < argc) {
+			++i;
+			int c = COLORMAP_HSV;
+			while (c < COLORMAP_COUNT && std::strcmp(argv[i], colormap_names[c]) != 0)
+				++c;
+			if (c == COLORMAP_COUNT)
+				unknownValue("colormap", argv[i], colormap_names);
+			export_cmap = (colormap_kind_t) c;
+		}
+	}
+
+	// every rank reads the config, the size of the grid is the one of the config unless --nx and --ny are given
+	if (config && !g_config.load(config))
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	g_nx = nx ? nx : g_config.nx;
+	g_ny = ny ? ny : g_config.ny;
 
+	if (g_halo == HALO_SHM)
+		initNodeComm();
+	if (g_halo == HALO_RMA_PSCW)
+		initNbGroup();
+
+	// every rank needs at least one row of the matrix
+	if ((size_t) g_world_size > g_nx) {
+		std::cerr << "World size must not be greater than " << g_nx << std::endl;
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
 
-	// We are assuming at least 2 processes for this task
-	if (g_world_size < 2) {
-		std::cerr << "World size must be greater than 1" << std::endl;
+	// the row and column sweeps run on omp threads inside each rank
+	if (provided < MPI_THREAD_FUNNELED) {
+		std::cerr << "MPI does not provide MPI_THREAD_FUNNELED" << std::endl;
 		MPI_Abort(MPI_COMM_WORLD, 1);
 	}
 
-	if (world_rank == 0) {
-		int Nx = NX, Ny = NY;
-		Mtrix M;
-		initMatrix(M, Nx, Ny);
-		plot(M, &Nx, &Ny);
+	if (g_world_rank == 0)
+		std::cout << "ranks: " << g_world_size << ", omp threads per rank: " << omp_get_max_threads()
+				  << ", halo exchange: " << g_halo_names[g_halo] << ", kernels: " << isa_names[isaSelected()] << std::endl;
+
+	// start with an even split, every rank fills its own slab with the initial values
+	Mtrix subM, M;
+	resize(subM, M, g_nx, g_ny);
+	if (restart && !readCheckpoint(subM, M, restart))
+		MPI_Abort(MPI_COMM_WORLD, 1);
+
+	// only node 0 writes frames, every rank takes part in the gathers
+	if (export_format != FRAME_FORMATS) {
+		std::string out = export_out ? export_out : export_format == FRAME_RAW ? std::string("frames.rgb")
+										  : std::string("frame_%06ld.") + frame_format_names[export_format];
+		colormap_t cmap;
+		cmap.build(export_cmap, min, max);
+		if (g_world_rank == 0 && !g_export.open(export_format, out, cmap, export_queue))
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		g_export_every = export_every;
+	}
+	if (history) {
+		if (g_world_rank == 0 && !g_history.open(history, history_keyframe, history_queue))
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		g_history_every = history_every;
+	}
+	g_checkpoint_every = checkpoint_every;
+
+	double seconds = 0;
+	if (g_world_rank == 0) {
+		int Nx = g_nx, Ny = g_ny;
+		if (headless_steps > 0)
+			seconds = headless(subM, M, headless_steps);
+		else if (plot(M, subM, &Nx, &Ny) != 0)
+			command(CMD_SHUTDOWN, 0, 0, subM, M);
 	} else {
-		Mtrix subM;
-		subM.init(NX /( g_world_size - 1), NY);
-		receive(subM, world_rank);
+		receive(subM);
 	}
 
-	MPI_Abort(MPI_COMM_WORLD, 0);
+	g_export.close();
+	if (g_world_rank == 0 && g_export_every > 0)
+		std::cout << "frames written: " << g_export.written << ", failed: " << g_export.failed
+				  << ", solver stalled on the queue: " << g_export.stalled << " s" << std::endl;
+
+	g_history.close();
+	if (g_world_rank == 0 && g_history_every > 0)
+		std::cout << "history frames: " << g_history.index.size() << ", failed: " << g_history.failed << ", "
+				  << g_history.raw_bytes / double(1 << 20) << " MB packed to " << g_history.packed_bytes / double(1 << 20)
+				  << " MB, solver stalled on the queue: " << g_history.stalled << " s" << std::endl;
+
+	// per rank trace files and a summary over the ranks on node 0
+	double comm = 0;
+	if (g_prof.enabled) {
+		g_prof.finish();
+		g_prof.writeTrace("tdma_prof." + std::to_string(g_world_rank) + ".csv");
+		g_prof.summary(MPI_COMM_WORLD);
+		comm = g_prof.commFraction(MPI_COMM_WORLD);
+	}
+
+	// one json line for the benchmark scripts
+	if (g_world_rank == 0 && headless_steps > 0) {
+		std::cout << "RESULT {\"ranks\": " << g_world_size << ", \"threads\": " << omp_get_max_threads()
+				  << ", \"nx\": " << g_nx << ", \"ny\": " << g_ny << ", \"halo\": \"" << g_halo_names[g_halo]
+				  << "\", \"steps\": " << headless_steps << ", \"seconds\": " << seconds
+				  << ", \"steps_per_s\": " << headless_steps / seconds
+				  << ", \"comm_fraction\": " << (g_prof.enabled ? std::to_string(comm) : "null") << "}" << std::endl;
+	}
+
+	// every rank writes its own trace, with the rank as the process id
+	TRACE_DUMP(("tdma_trace." + std::to_string(g_world_rank) + ".json").c_str(), g_world_rank);
+
+	freeSlab(subM);
+	if (g_node_comm != MPI_COMM_NULL)
+		MPI_Comm_free(&g_node_comm);
+	if (g_nb_group != MPI_GROUP_NULL)
+		MPI_Group_free(&g_nb_group);
 	MPI_Finalize();
 }
 
@@ -0,0 +1,68 @@
+#include "iostream"
+#include "fstream"
+#include "cstring"
+#include "cstdlib"
+
+#include "include/Matrix.h"
+#include "include/History.h"
+
+// list the frames of a history file, or extract the frame of one step in the layout of the snapshots of tdma_2d_mpi
+// (nx, ny and step as 64 bit integers followed by the rows as doubles), which --restart reads back
+template <typename T>
+int run(const char* path, int argc, char** argv) {
+	history_reader_t<T> reader;
+	if (!reader.open(path)) {
+		std::cerr << "cannot read the history " << path << std::endl;
+		return 1;
+	}
+
+	if (argc < 4) {
+		std::cout << "frame step nx ny key" << std::endl;
+		for (size_t k = 0; k < reader.frames(); ++k) {
+			const hist_entry_t& e = reader.index[k];
+			std::cout << k << " " << e.step << " " << e.rows - 2 << " " << e.cols - 2 << " " << e.key << std::endl;
+		}
+		return 0;
+	}
+
+	long frame = reader.find(std::strtol(argv[2], nullptr, 10));
+	matrix_t<T> M;
+	if (frame < 0 || !reader.read(frame, M)) {
+		std::cerr << "no frame at step " << argv[2] << std::endl;
+		return 1;
+	}
+
+	std::ofstream out(argv[3], std::ios::binary);
+	uint64_t header[3] = {M.N(), M.M(), reader.index[frame].step};
+	out.write((const char*) header, sizeof(header));
+	for (size_t i = 0; i < M.N() + 2; ++i) {
+		for (size_t j = 0; j < M.M() + 2; ++j) {
+			double v = M[i][j];
+			out.write((const char*) &v, sizeof(v));
+		}
+	}
+	return out ? 0 : 1;
+}
+
+// Main program
+int main(int argc, char** argv) {
+	if (argc != 2 && argc != 4) {
+		std::cerr << "usage: " << argv[0] << " <history>                    list the frames" << std::endl
+				  << "       " << argv[0] << " <history> <step> <out.bin>   extract the frame of a step" << std::endl;
+		return 1;
+	}
+
+	// the element type of the frames is the one of the solver that wrote them
+	FILE* f = fopen(argv[1], "rb");
+	hist_header_t header;
+	bool ok = f && fread(&header, sizeof(header), 1, f) == 1;
+	if (f) fclose(f);
+	if (!ok || memcmp(header.magic, hist_magic, 8) != 0) {
+		std::cerr << argv[1] << " is not a history file" << std::endl;
+		return 1;
+	}
+
+	if (header.elem == sizeof(float))
+		return run<float>(argv[1], argc, argv);
+	return run<double>(argv[1], argc, argv);
+}